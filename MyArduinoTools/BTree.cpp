@@ -0,0 +1,341 @@
+#include <Arduino.h>
+
+#include "BTree.h"
+
+namespace om {
+
+namespace {
+
+uint16_t load16(const char* data)
+{
+	uint16_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+uint32_t load32(const char* data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+void store16(char* data, uint16_t value)
+{
+	memcpy(data, &value, sizeof(value));
+}
+
+void store32(char* data, uint32_t value)
+{
+	memcpy(data, &value, sizeof(value));
+}
+
+}
+
+BTree::BTree(const char* fileName, uint8_t valueSize)
+	: m_valueSize(valueSize)
+{
+	strncpy(m_name, fileName, 9);
+	m_name[9] = '\0';
+}
+
+int BTree::begin(uint16_t maxNodes)
+{
+	// the count byte takes one entry more than the capacity while splitting,
+	// thus nodes of large pages (e.g. NOR flash sectors) stay partly unused.
+	m_pageSize = flashFs.pageSize();
+	const uint16_t leafCapacity = (m_pageSize - HEADERSIZE) / (4 + m_valueSize);
+	const uint16_t innerCapacity = (m_pageSize - HEADERSIZE - 2) / 6;
+	if ((leafCapacity < 3) || (innerCapacity < 3))
+		return latchError(ERROR_VALUE_SIZE);
+	m_leafCapacity = (leafCapacity < MAXCAPACITY) ? leafCapacity : MAXCAPACITY;
+	m_innerCapacity = (innerCapacity < MAXCAPACITY) ? innerCapacity : MAXCAPACITY;
+
+	const uint16_t slack = (4 + m_valueSize > 6) ? 4 + m_valueSize : 6;
+	m_node = new char[m_pageSize + slack];
+	m_sibling = new char[m_pageSize + slack];
+
+	if (   (m_file.openFile(m_name) < 0)
+		&& (m_file.createFile(m_name, uint32_t(maxNodes) * m_pageSize) < 0))
+		return latchError(m_file.lastError());
+	m_maxNodes = m_file.size() / m_pageSize;
+	if (m_maxNodes < 2)
+		return latchError(ERROR_TREE_FULL);
+
+	m_file.setPos(0);
+	if (m_file.read(m_meta) < 0)
+		return latchError(m_file.lastError());
+	if (m_meta.magic == MAGIC_BTREE)
+	{
+		// an index of another device or value type stays untouched
+		const int result = (m_meta.pageSize != m_pageSize) ? ERROR_PAGE_SIZE
+						 : (m_meta.valueSize != m_valueSize) ? ERROR_VALUE_SIZE
+						 : FlashFS::ERROR_NONE;
+		if (result < 0)
+			m_meta.magic = 0;
+		return latchError(result);
+	}
+
+	// fresh index: an empty leaf as root
+	m_meta.magic = MAGIC_BTREE;
+	m_meta.pageSize = m_pageSize;
+	m_meta.valueSize = m_valueSize;
+	m_meta.height = 1;
+	m_meta.root = 1;
+	m_meta.nodes = 2;
+	m_meta.reserved = 0;
+	char* root = m_node.get();
+	root[0] = 1;
+	root[1] = 0;
+	store16(root + 2, 0);
+	const int result = writeNode(m_meta.root, root);
+	if (result < 0)
+		return result;
+	return latchError(writeMeta());
+}
+
+int BTree::insert(uint32_t key, const void* value)
+{
+	if (m_meta.magic != MAGIC_BTREE)
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
+
+	// descent, keeping the path for the splits
+	uint16_t path[MAXHEIGHT];
+	uint8_t slot[MAXHEIGHT];
+	uint8_t level = 0;
+	uint16_t idx = m_meta.root;
+	char* node = m_node.get();
+	int result = readNode(idx, node);
+	while ((result >= 0) && (node[0] == 0))
+	{
+		path[level] = idx;
+		slot[level] = innerUpperBound(node, key);
+		idx = innerChild(node, slot[level]);
+		++level;
+		result = readNode(idx, node);
+	}
+	if (result < 0)
+		return result;
+
+	const uint8_t entrySize = leafSize();
+	uint8_t count = nodeCount(node);
+	const uint8_t pos = leafLowerBound(node, key);
+	char* entry = node + HEADERSIZE + pos * entrySize;
+	if ((pos < count) && (leafKey(node, pos) == key))
+	{
+		memcpy(entry + 4, value, m_valueSize);	// replace
+		result = writeNode(idx, node);
+		return (result < 0) ? result : latchError(FlashFS::ERROR_NONE);
+	}
+
+	const bool split = (count == m_leafCapacity);
+	if (   split
+		&& (   (m_meta.nodes + m_meta.height + 1 > m_maxNodes)
+			|| (m_meta.height == MAXHEIGHT)))
+		return latchError(ERROR_TREE_FULL);
+
+	memmove(entry + entrySize, entry, (count - pos) * entrySize);
+	store32(entry, key);
+	memcpy(entry + 4, value, m_valueSize);
+	node[1] = ++count;
+	if (!split)
+	{
+		result = writeNode(idx, node);
+		return (result < 0) ? result : latchError(FlashFS::ERROR_NONE);
+	}
+
+	// leaf split: appending to the last leaf leaves it full, otherwise half
+	char* sibling = m_sibling.get();
+	const bool append = (pos + 1 == count) && (nextLeaf(node) == 0);
+	const uint8_t keep = append ? count - 1 : count / 2;
+	uint16_t right = m_meta.nodes++;
+	sibling[0] = 1;
+	sibling[1] = count - keep;
+	store16(sibling + 2, nextLeaf(node));
+	memcpy(sibling + HEADERSIZE, node + HEADERSIZE + keep * entrySize, (count - keep) * entrySize);
+	node[1] = keep;
+	store16(node + 2, right);
+	uint32_t separator = leafKey(sibling, 0);
+	if (   ((result = writeNode(right, sibling)) < 0)
+		|| ((result = writeNode(idx, node)) < 0))
+		return result;
+
+	// insert (separator, right) into the parents, splitting them if full
+	while (level > 0)
+	{
+		--level;
+		idx = path[level];
+		if ((result = readNode(idx, node)) < 0)
+			return result;
+
+		count = nodeCount(node);
+		char* at = node + HEADERSIZE + 2 + slot[level] * 6;
+		memmove(at + 6, at, (count - slot[level]) * 6);
+		store32(at, separator);
+		store16(at + 4, right);
+		node[1] = ++count;
+		if (count <= m_innerCapacity)
+		{
+			if ((result = writeNode(idx, node)) < 0)
+				return result;
+			return latchError(writeMeta());
+		}
+
+		// keys [0, middle) stay, key middle moves up, the rest goes right
+		const uint8_t middle = (slot[level] + 1 == count) ? count - 2 : count / 2;
+		separator = innerKey(node, middle);
+		right = m_meta.nodes++;
+		sibling[0] = 0;
+		sibling[1] = count - middle - 1;
+		store16(sibling + 2, 0);
+		memcpy(sibling + HEADERSIZE, node + HEADERSIZE + (middle + 1) * 6, (count - middle - 1) * 6 + 2);
+		node[1] = middle;
+		if (   ((result = writeNode(right, sibling)) < 0)
+			|| ((result = writeNode(idx, node)) < 0))
+			return result;
+	}
+
+	// root split: the tree grows by one level
+	const uint16_t root = m_meta.nodes++;
+	node[0] = 0;
+	node[1] = 1;
+	store16(node + 2, 0);
+	store16(node + HEADERSIZE, m_meta.root);
+	store32(node + HEADERSIZE + 2, separator);
+	store16(node + HEADERSIZE + 6, right);
+	if ((result = writeNode(root, node)) < 0)
+		return result;
+	m_meta.root = root;
+	++m_meta.height;
+	return latchError(writeMeta());
+}
+
+int BTree::find(uint32_t key, void* value)
+{
+	uint8_t pos;
+	const int result = seekLeaf(key, pos);
+	if (result < 0)
+		return result;
+
+	const char* node = m_node.get();
+	if ((pos == nodeCount(node)) || (leafKey(node, pos) != key))
+		return latchError(ERROR_KEY_NOT_FOUND);
+	memcpy(value, leafValue(node, pos), m_valueSize);
+	return latchError(m_valueSize);
+}
+
+int BTree::latchError(int val)
+{
+	m_lastError = (val < 0) ? val : FlashFS::ERROR_NONE;
+	return val;
+}
+
+int BTree::readNode(uint16_t idx, char* node)
+{
+	m_file.setPos(uint32_t(idx) * m_pageSize);
+	const int result = m_file.read(node, m_pageSize);
+	return (result < 0) ? latchError(result) : result;
+}
+
+int BTree::writeNode(uint16_t idx, const char* node)
+{
+	// the used part of the node's page only. A node beyond the high-water
+	// mark (a new one) is written as a whole page: later writes to it stay
+	// below the mark, which is persisted by writeMeta() only.
+	const uint32_t start = uint32_t(idx) * m_pageSize;
+	uint16_t used = (node[0] != 0)
+				  ? HEADERSIZE + nodeCount(node) * leafSize()
+				  : HEADERSIZE + 2 + nodeCount(node) * 6;
+	if (start + m_pageSize > m_file.written())
+		used = m_pageSize;
+	m_file.setPos(start);
+	const int result = m_file.write(node, used);
+	return (result < 0) ? latchError(result) : result;
+}
+
+int BTree::writeMeta()
+{
+	// records the mark covering the new nodes before the meta refers to them
+	int result = m_file.flush();
+	if (result >= 0)
+	{
+		m_file.setPos(0);
+		result = m_file.write(m_meta);
+	}
+	return (result < 0) ? latchError(result) : FlashFS::ERROR_NONE;
+}
+
+int BTree::seekLeaf(uint32_t key, uint8_t &pos)
+{
+	if (m_meta.magic != MAGIC_BTREE)
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
+
+	char* node = m_node.get();
+	int result = readNode(m_meta.root, node);
+	while ((result >= 0) && (node[0] == 0))
+		result = readNode(innerChild(node, innerUpperBound(node, key)), node);
+	if (result < 0)
+		return result;
+
+	pos = leafLowerBound(node, key);
+	return latchError(FlashFS::ERROR_NONE);
+}
+
+uint16_t BTree::nextLeaf(const char* node) const
+{
+	return load16(node + 2);
+}
+
+uint32_t BTree::leafKey(const char* node, uint8_t i) const
+{
+	return load32(node + HEADERSIZE + i * leafSize());
+}
+
+const char* BTree::leafValue(const char* node, uint8_t i) const
+{
+	return node + HEADERSIZE + i * leafSize() + 4;
+}
+
+uint8_t BTree::leafLowerBound(const char* node, uint32_t key) const
+{
+	// first entry with a key >= key
+	uint8_t low = 0;
+	uint8_t high = nodeCount(node);
+	while (low < high)
+	{
+		const uint8_t mid = (low + high) / 2;
+		if (leafKey(node, mid) < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+uint16_t BTree::innerChild(const char* node, uint8_t i) const
+{
+	return load16(node + HEADERSIZE + i * 6);
+}
+
+uint32_t BTree::innerKey(const char* node, uint8_t i) const
+{
+	return load32(node + HEADERSIZE + 2 + i * 6);
+}
+
+uint8_t BTree::innerUpperBound(const char* node, uint32_t key) const
+{
+	// child i holds the keys of [key i-1, key i)
+	uint8_t low = 0;
+	uint8_t high = nodeCount(node);
+	while (low < high)
+	{
+		const uint8_t mid = (low + high) / 2;
+		if (innerKey(node, mid) <= key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+}
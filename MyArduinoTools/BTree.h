@@ -0,0 +1,160 @@
+#ifndef OM_BTREE_H
+#define OM_BTREE_H
+
+#include <stdint.h>
+
+#include "FlashFS.h"
+#include "omMemory.h"
+
+namespace om {
+
+// B+tree index in a FlashFS file, mapping uint32_t keys (e.g. timestamps) to
+// values of fixed size. Each node is one EEPROM page at a page aligned file
+// position, thus a lookup reads one page per level. Leaves are chained for
+// range scans. Appending ascending keys fills the nodes completely.
+//
+// node 0:	meta data
+// leaf:	[1][count][next 2] count x [key 4][value]
+// inner:	[0][count][-    2] [child 2] count x [key 4][child 2]
+class BTree
+{
+public:
+	static const int ERROR_KEY_NOT_FOUND		= -30;
+	static const int ERROR_VALUE_SIZE			= -31;
+	static const int ERROR_TREE_FULL			= -32;
+	static const int ERROR_PAGE_SIZE			= -33;
+
+	// fileName up to 9 chars.
+	BTree(const char* fileName, uint8_t valueSize);
+
+	int	lastError() const
+	{
+		return m_lastError;
+	}
+
+	// opens the index, creating its file of maxNodes pages if missing. An
+	// index written with another page or value size is an error.
+	int begin(uint16_t maxNodes);
+
+	uint8_t height() const
+	{
+		return m_meta.height;
+	}
+
+	uint16_t nodes() const
+	{
+		return m_meta.nodes;
+	}
+
+	// inserts or replaces the value of key, ERROR_NONE on success
+	int insert(uint32_t key, const void* value);
+
+	template<typename T>
+	int insert(uint32_t key, const T &value)
+	{
+		if (sizeof(T) != m_valueSize)
+			return latchError(ERROR_VALUE_SIZE);
+		return insert(key, static_cast<const void*>(&value));
+	}
+
+	int find(uint32_t key, void* value);
+
+	template<typename T>
+	int find(uint32_t key, T &value)
+	{
+		if (sizeof(T) != m_valueSize)
+			return latchError(ERROR_VALUE_SIZE);
+		return find(key, static_cast<void*>(&value));
+	}
+
+	// calls visit(uint32_t key, const void* value) for each key of [from, to]
+	// in ascending order, leaf by leaf. visit must not modify the index.
+	// Returns the number of visited keys.
+	template<typename F>
+	int32_t scan(uint32_t from, uint32_t to, F visit)
+	{
+		uint8_t pos;
+		const int result = seekLeaf(from, pos);
+		if (result < 0)
+			return result;
+
+		int32_t visited = 0;
+		for (;;)
+		{
+			for (; pos < nodeCount(m_node.get()); ++pos)
+			{
+				const uint32_t key = leafKey(m_node.get(), pos);
+				if (key > to)
+					return visited;
+				visit(key, leafValue(m_node.get(), pos));
+				++visited;
+			}
+			const uint16_t next = nextLeaf(m_node.get());
+			if ((next == 0) || (readNode(next, m_node.get()) < 0))
+				return visited;
+			pos = 0;
+		}
+	}
+
+private:
+	static const uint16_t MAGIC_BTREE			= 0x5442;	// "BT"
+	static const uint8_t HEADERSIZE				= 4;
+	static const uint8_t MAXHEIGHT				= 10;
+	static const uint8_t MAXCAPACITY			= 254;
+
+	struct Meta
+	{
+		uint16_t	magic;
+		uint16_t	pageSize;
+		uint8_t		valueSize;
+		uint8_t		height;
+		uint16_t	root;
+		uint16_t	nodes;				// allocated, including meta node 0
+		uint16_t	reserved;
+	};
+
+	int latchError(int val);
+	int readNode(uint16_t idx, char* node);
+	int writeNode(uint16_t idx, const char* node);
+	int writeMeta();
+	int seekLeaf(uint32_t key, uint8_t &pos);
+
+	// node access
+	static uint8_t nodeCount(const char* node)
+	{
+		return uint8_t(node[1]);
+	}
+
+	uint8_t leafSize() const
+	{
+		return 4 + m_meta.valueSize;
+	}
+
+	uint16_t nextLeaf(const char* node) const;
+	uint32_t leafKey(const char* node, uint8_t i) const;
+	const char* leafValue(const char* node, uint8_t i) const;
+	uint8_t leafLowerBound(const char* node, uint32_t key) const;
+	uint16_t innerChild(const char* node, uint8_t i) const;
+	uint32_t innerKey(const char* node, uint8_t i) const;
+	uint8_t innerUpperBound(const char* node, uint32_t key) const;
+
+	char		m_name[10];
+	uint8_t		m_valueSize;
+	uint16_t	m_pageSize{0};
+	uint16_t	m_maxNodes{0};
+	uint8_t		m_leafCapacity{0};
+	uint8_t		m_innerCapacity{0};
+	Meta		m_meta{};
+
+	// a node buffer holds one entry more than a page, thus a full node is
+	// split after inserting.
+	unique_ptr<char, _array_destructor> m_node;
+	unique_ptr<char, _array_destructor> m_sibling;
+
+	File		m_file;
+	int			m_lastError{FlashFS::ERROR_NONE};
+};
+
+}
+
+#endif
@@ -1,21 +1,58 @@
 #include <Arduino.h>
 #include <Wire.h>
+#include <stddef.h>
 
 #include "FlashFS.h"
 #include "omMemory.h"
 
+#if defined(FS_DIRECT_TWI) && defined(__AVR__)
+	#include <util/twi.h>
+	#define FS_TWI_PAGE_WRITE
+#endif
+
+#ifndef FS_WIRE_BUFFER_LENGTH
+	#define FS_WIRE_BUFFER_LENGTH	BUFFER_LENGTH
+#endif
+
 namespace om {
 
 #define DEBUG_BUFLEN 128
 char _dbg_buffer[DEBUG_BUFLEN];
 int	 _flashFs_lastError = FlashFS::ERROR_NONE;
 
-FlashFS::FlashFS(uint8_t deviceAddress, uint32_t deviceSize, uint8_t pageSize)
+#ifndef FS_STATIC_DEVICE_SIZE
+FlashFS::FlashFS(uint8_t deviceAddress, uint32_t deviceSize, uint16_t pageSize)
+	: FlashFS(deviceAddress, deviceSize, pageSize, false)
+{
+}
+#endif
+
+FlashFS::FlashFS(uint8_t deviceAddress, uint32_t deviceSize, uint16_t pageSize, bool fixedGeometry)
 	: m_dbgEnable(false)
+	, m_geometryProbed(false)
+	, m_fixedGeometry(fixedGeometry)
+	, m_batchDepth(0)
+	, m_batchPending(false)
+	, m_writeFailed(false)
+	, m_restoreAddress(0)
+	, m_restoreSize(0)
+	, m_restoreFill(0)
+#ifdef FS_TRACE
+	, m_traceOut(nullptr)
+	, m_traceStart(0)
+	, m_traceAddress(0)
+	, m_traceEnd(0)
+	, m_traceFill(0)
+#endif
 	, m_deviceAddress(deviceAddress)
 	, m_deviceSize(deviceSize)
 	, m_pageSize(pageSize)
 	, m_openFile(-1) // none
+	, m_shadow()
+	, m_shadowOf(0)
+#ifndef FS_USE_SEPARATE_FILE
+	, m_markPending(false)
+#endif
 {
 }
 
@@ -29,24 +66,79 @@ int	FlashFS::lastError() const
 	return _flashFs_lastError;
 }
 
-bool FlashFS::openDevice(uint8_t deviceAddress, uint32_t deviceSize, uint8_t pageSize)
+bool FlashFS::openDevice(uint8_t deviceAddress, uint32_t deviceSize, uint16_t pageSize)
 {
+	if (m_fixedGeometry && ((deviceSize != m_deviceSize) || (pageSize != m_pageSize)))
+	{
+		latchError(ERROR_GEOMETRY_FIXED);
+		return false;
+	}
+	if (pageSize < MINPAGESIZE)
+	{
+		latchError(ERROR_PAGE_SIZE);
+		return false;
+	}
 	m_deviceAddress = deviceAddress;
 	m_deviceSize = deviceSize;
 	m_pageSize = pageSize;
+	m_geometryProbed = false;
 	return openDevice();
 }
 
+bool FlashFS::openDevice(bool probeGeometry)
+{
+	const bool mounted = openDevice();
+	if (m_fixedGeometry)
+		return mounted;
+	if (mounted && (m_dir.deviceSizeLog2 != 0))	// probed before
+	{
+		m_deviceSize = uint32_t(1) << m_dir.deviceSizeLog2;
+		m_pageSize   = m_dir.pageSize;
+		m_geometryProbed = true;
+		return true;
+	}
+	// the probes write scratch bytes into the directory header and the last
+	// 256 bytes, thus a formatted device keeps the given geometry
+	if (mounted || !probeGeometry || (m_deviceSize == EEPROMSize2k))
+		return mounted;
+
+	m_deviceSize = probeDeviceSize();
+	m_pageSize   = probePageSize();
+	if (m_dbgEnable)
+	{
+		snprintf(_dbg_buffer, DEBUG_BUFLEN, "probed: size %lu, page %d"
+										  , (unsigned long)m_deviceSize, m_pageSize);
+		Serial.println(_dbg_buffer);
+	}
+	if (m_pageSize < MINPAGESIZE)
+	{
+		latchError(ERROR_PAGE_SIZE);	// not recorded
+		return false;
+	}
+	m_geometryProbed = true;
+	return false;	// recorded by format()
+}
+
 bool FlashFS::openDevice()
 {
 #ifndef FS_USE_SEPARATE_FILE
+	m_markPending = false;			// the device may have changed
 	close();
 #else
 	m_openFile = -1;
+#endif
+	m_shadow.startAddress = 0;
+	m_batchDepth = 0;				// pending changes are discarded
+	m_batchPending = false;
+#ifdef FS_PIN_BUDGET
+	dropPins();						// the device may have changed
 #endif
 	// read version and directory start
-	memset(&m_dir, 0, sizeof(Directory));	// restart from scratch
-	read(0x0, reinterpret_cast<char*>(&m_dir), sizeof(Directory));
+	memset(&m_dir, 0, sizeof(m_dir));	// restart from scratch
+#ifdef FS_LITE_DIRECTORY
+	clearCache();						// entries are loaded on demand
+#endif
+	read(0x0, reinterpret_cast<char*>(&m_dir), sizeof(m_dir));
 
 	return (m_dir.magicID  == MAGIC_TLFILESYSTEM)	// ? not mine
         && (m_dir.version  == FILESYSTEMVERSION)	// ? structure changed
@@ -55,18 +147,39 @@ bool FlashFS::openDevice()
 
 void FlashFS::format(const char* storageName)
 {
+#ifdef FS_TRACE
+	traceName(TRACE_FORMAT, storageName, 0, 0);
+	if (m_tracePage)
+		stopTrace();		// the trace file is gone
+#endif
 #ifndef FS_USE_SEPARATE_FILE
+	m_markPending = false;
 	close();
 #else
 	m_openFile = -1;
 #endif
-	memset(&m_dir, 0, sizeof(Directory));	// restart from scratch
+	m_shadow.startAddress = 0;
+	m_batchDepth = 0;
+	m_batchPending = false;
+#ifdef FS_PIN_BUDGET
+	dropPins();
+#endif
+	memset(&m_dir, 0, sizeof(m_dir));	// restart from scratch
+#ifdef FS_LITE_DIRECTORY
+	clearCache();
+#endif
 
 	m_dir.magicID  = MAGIC_TLFILESYSTEM;	// "TLFS", const
-	m_dir.version  = FILESYSTEMVERSION;		// for now it's version 1.0
+	m_dir.version  = FILESYSTEMVERSION;		// for now it's version 1.2
 	strncpy(m_dir.name, storageName, MAXNAMELEN);
 	m_dir.name[MAXNAMELEN] = '\0';
 	m_dir.numFiles = 0;
+	if (m_geometryProbed)
+	{
+		while ((uint32_t(1) << m_dir.deviceSizeLog2) < m_deviceSize)
+			++m_dir.deviceSizeLog2;
+		m_dir.pageSize = m_pageSize;
+	}
 	writeDirectory();
 }
 
@@ -98,14 +211,14 @@ void FlashFS::dir() const
 		const auto ep = flashFs.fileEntry(i);
 		snprintf(_dbg_buffer, DEBUG_BUFLEN
 				, "%3d %-10s %6lu 0x%06lx"
-				, i, ep->name, ep->size, ep->startAddress);
+				, i, ep->name, (unsigned long)ep->size, (unsigned long)ep->startAddress);
 		Serial.println(_dbg_buffer);
 		used += pageAlign(ep->size, true);
 	}
 	Serial.println();
 	snprintf(_dbg_buffer, DEBUG_BUFLEN
 		    , "%6lu bytes used, %6lu bytes free"
-	        , used, m_deviceSize - used);
+	        , (unsigned long)used, (unsigned long)(m_deviceSize - used));
 	Serial.println(_dbg_buffer);
 	Serial.println(dash);
 }
@@ -114,7 +227,7 @@ const FlashFS::FileEntry* FlashFS::fileEntry(int idx) const
 {
 	if ((idx < 0) || (uint32_t(idx) >= m_dir.numFiles))
 		return nullptr;
-	return m_dir.files + idx;
+	return &entry(idx);
 }
 
 const FlashFS::FileEntry* FlashFS::grantFileAccess()
@@ -137,24 +250,95 @@ int FlashFS::deleteFile(const char* fileName)
 
 	if (m_openFile == idx)
 #ifndef FS_USE_SEPARATE_FILE
+	{
+		m_markPending = false;
 		close(); // forced close.
+	}
 #else
 		m_openFile = -1;
 #endif
 
+#ifdef FS_TRACE
+	traceName(TRACE_DELETE, fileName, 0, 0);
+#endif
+#ifdef FS_PIN_BUDGET
+	dropPin(entry(idx).startAddress);
+#endif
 	removeFilesEntry(idx);
 	writeDirectory();
 
 	return latchError(ERROR_NONE);
 }
 
+int FlashFS::resizeFile(const char* fileName, uint32_t newSize)
+{
+	int idx = findFile(fileName);
+	if (idx < 0)
+		return latchError(ERROR_FILE_NOT_FOUND);
+
+#ifdef FS_TRACE
+	traceName(TRACE_RESIZE, fileName, newSize, 0);
+#endif
+	FileEntry resized = entry(idx);
+	const uint32_t oldStart = resized.startAddress;
+	resized.size = newSize;
+	if (resized.written > newSize)
+		resized.written = newSize;	// only valid data needs to be copied
+
+	// e.g. resizing FILE2:
+	//	[FILE1] <--a--> [FILE2] <--b--> [FILE3]
+	//	- fits into FILE2 + b: stays where it is
+	//	- fits elsewhere: copied to the best fitting gap, old data untouched
+	//	- fits into a + FILE2 + b: slides down, overlapping copy
+	// Either way the file switches with a single write of its entry's head.
+	Extent extents[MAXFILEENTRIES + 1];
+	const uint8_t count = collectExtents(extents);
+	uint8_t own = 0;
+	while (extents[own].start != oldStart)
+		++own;
+	const uint32_t limit = (own + 1 < count) ? extents[own+1].start : m_deviceSize;
+	const uint32_t below = (own > 0) ? extents[own-1].end : pageAlign(sizeof(Directory), true);
+	if (oldStart + newSize <= limit)
+	{
+		writeEntryHead(idx, resized);
+#ifdef FS_PIN_BUDGET
+		reloadPin(oldStart, fileName);
+#endif
+		return latchError(int(newSize));
+	}
+
+	GapInfo gap = findBestFittingGap(newSize);
+	if (gap.insertAt >= 0)
+		resized.startAddress = gap.startAddress;
+	else if (below + newSize <= limit)
+		resized.startAddress = below;
+	else
+		return latchError(ERROR_NOT_ENOUGH_SPACE);
+
+	copyData(oldStart, resized.startAddress, resized.written);
+	writeEntryHead(idx, resized);
+#ifdef FS_PIN_BUDGET
+	reloadPin(oldStart, fileName);
+#endif
+	return latchError(int(newSize));
+}
+
 int FlashFS::createFile(const char* fileName, uint32_t size)
 {
+#ifndef FS_USE_SEPARATE_FILE
+	if (m_markPending)
+		flush();
+#endif
 	// a chance to relocate file, looking for better place
 	// then performing deleteFile & createFile in one step:
 	int existingFile = findFile(fileName);
 	if (existingFile >= 0)
+	{
+#ifdef FS_PIN_BUDGET
+		dropPin(entry(existingFile).startAddress);
+#endif
 		removeFilesEntry(existingFile);
+	}
 
 	if (m_dir.numFiles == MAXFILEENTRIES)
 		return latchError(ERROR_DIR_TABLE_FULL);
@@ -166,17 +350,20 @@ int FlashFS::createFile(const char* fileName, uint32_t size)
 	insertFilesEntry(gap.insertAt);
 	if (m_dbgEnable)
 	{
-		snprintf(_dbg_buffer, DEBUG_BUFLEN, "cr: [%3d] %s addr 0x%06lx, size %ld of %ld"
-									 , gap.insertAt
-									 , fileName, gap.startAddress, size, gap.gapSize);
+		snprintf(_dbg_buffer, DEBUG_BUFLEN, "cr: [%3d] %s addr 0x%06lx, size %lu of %lu"
+									 , gap.insertAt, fileName, (unsigned long)gap.startAddress
+									 , (unsigned long)size, (unsigned long)gap.gapSize);
 		Serial.println(_dbg_buffer);
 	}
 
-	FileEntry& newEntry = m_dir.files[gap.insertAt];
+	FileEntry newEntry;
 	newEntry.startAddress = gap.startAddress;
 	newEntry.size = size;
+	newEntry.written = 0;					// sparse, reads as zeros
+	newEntry.fillWord = 0x0;
 	strncpy(newEntry.name, fileName, MAXNAMELEN);
 	newEntry.name[MAXNAMELEN] = '\0';
+	storeEntry(gap.insertAt, newEntry);
 
 	writeDirectory();
 
@@ -186,6 +373,10 @@ int FlashFS::createFile(const char* fileName, uint32_t size)
 
 int FlashFS::openFile(const char* fileName)
 {
+#ifndef FS_USE_SEPARATE_FILE
+	if (m_markPending)
+		flush();
+#endif
 	m_openFile = findFile(fileName);
 #ifndef FS_USE_SEPARATE_FILE
 	m_filePos = 0;
@@ -193,42 +384,143 @@ int FlashFS::openFile(const char* fileName)
 	if (m_openFile < 0)
 		return latchError(ERROR_FILE_NOT_FOUND);	// not found
 
-	return latchError(int(m_dir.files[m_openFile].size));
+	return latchError(int(entry(m_openFile).size));
+}
+
+const FlashFS::FileEntry* FlashFS::fileEntryAt(uint32_t startAddress) const
+{
+	for(int i = 0; uint32_t(i) < m_dir.numFiles; ++i)
+		if (entry(i).startAddress == startAddress)
+			return &entry(i);
+	return nullptr;
+}
+
+const FlashFS::FileEntry* FlashFS::reserveShadow(const char* fileName, uint32_t size)
+{
+	if (m_shadow.startAddress != 0)
+	{
+		latchError(ERROR_UPDATE_PENDING);
+		return nullptr;
+	}
+
+	const int idx = findFile(fileName);
+	if (idx < 0)
+	{
+		latchError(ERROR_FILE_NOT_FOUND);
+		return nullptr;
+	}
+
+	// the current content stays untouched, so the gap can't overlap it.
+	const GapInfo gap = findBestFittingGap(size);
+	if (gap.insertAt < 0)
+	{
+		latchError(gap.insertAt);
+		return nullptr;
+	}
+
+	m_shadow = entry(idx);
+	m_shadowOf = m_shadow.startAddress;
+	m_shadow.startAddress = gap.startAddress;
+	m_shadow.size = size;
+	m_shadow.written = 0;
+	m_shadow.fillWord = 0x0;
+	latchError(ERROR_NONE);
+	return &m_shadow;
+}
+
+int FlashFS::commitShadow(uint32_t shadowStart, uint32_t written, uint32_t fillWord)
+{
+	if ((m_shadow.startAddress == 0) || (m_shadow.startAddress != shadowStart))
+		return latchError(ERROR_NO_UPDATE);
+
+	FileEntry updated = m_shadow;
+	updated.written = written;
+	updated.fillWord = fillWord;
+	m_shadow.startAddress = 0;
+	for(int i = 0; uint32_t(i) < m_dir.numFiles; ++i)
+		if (   (entry(i).startAddress == m_shadowOf)
+			&& (strncmp(entry(i).name, updated.name, MAXNAMELEN) == 0))
+		{
+			writeEntryHead(i, updated);
+#ifdef FS_PIN_BUDGET
+			reloadPin(m_shadowOf, updated.name);
+#endif
+			return latchError(int(updated.size));
+		}
+	return latchError(ERROR_FILE_NOT_FOUND);	// deleted meanwhile
+}
+
+void FlashFS::releaseShadow(uint32_t shadowStart)
+{
+	if (m_shadow.startAddress == shadowStart)
+		m_shadow.startAddress = 0;
+}
+
+int FlashFS::updateSparseState(uint32_t startAddress, uint32_t written, uint32_t fillWord, bool persist)
+{
+	for(int i = 0; uint32_t(i) < m_dir.numFiles; ++i)
+		if (entry(i).startAddress == startAddress)
+		{
+			if (persist)
+			{
+				m_writeFailed = false;
+				setSparseState(i, written, fillWord);
+				if (m_writeFailed)
+					return latchError(ERROR_DEVICE_WRITE);
+			}
+			else
+			{
+				FileEntry update = entry(i);
+				update.written = written;
+				update.fillWord = fillWord;
+				storeEntry(i, update);
+			}
+			return latchError(ERROR_NONE);
+		}
+	return latchError(ERROR_FILE_NOT_FOUND);	// deleted meanwhile
 }
 
 #ifndef FS_USE_SEPARATE_FILE
 int FlashFS::cleanFile(uint32_t fillWord)
 {
 	if (m_openFile < 0)
-		latchError(ERROR_FILE_NOT_OPENED);
+		return latchError(ERROR_FILE_NOT_OPENED);
 
-	const int tempSize = m_pageSize / sizeof(uint32_t);
-	unique_ptr<uint32_t, _array_destructor> temp = new uint32_t[tempSize];
-	for(int i = 0; i < tempSize; ++i)
-		temp[i] = fillWord;
-	
-	const uint32_t restorePos = pos();
+	// sparse: nothing to write, the fillWord is reproduced while reading
+	m_markPending = false;
+	setSparseState(m_openFile, 0, fillWord);
+	return latchError(entry(m_openFile).size);
+}
+#endif
+
+#ifndef FS_USE_SEPARATE_FILE
+int FlashFS::flush()
+{
+	const bool pending = m_markPending;
+	m_markPending = false;
+	if (m_openFile < 0)
+		return latchError(ERROR_FILE_NOT_OPENED);
 
-	setPos(0);
-	uint32_t bytesToWrite = m_dir.files[m_openFile].size;
-	while (bytesToWrite > 0)
+	if (pending)
 	{
-		uint32_t chunkSize = bytesToWrite;
-		if (chunkSize > tempSize * sizeof(uint32_t))
-			chunkSize = tempSize * sizeof(uint32_t);
-		write(temp.get(), chunkSize);
-		bytesToWrite -= chunkSize;
+		const FileEntry current = entry(m_openFile);
+		m_writeFailed = false;
+		setSparseState(m_openFile, current.written, current.fillWord);
+		if (m_writeFailed)
+		{
+			m_markPending = true;
+			return latchError(ERROR_DEVICE_WRITE);
+		}
 	}
-
-	// cleanup:
-	setPos(restorePos);
-	return latchError(m_dir.files[m_openFile].size);
+	return latchError(ERROR_NONE);
 }
 #endif
 
 #ifndef FS_USE_SEPARATE_FILE
 void FlashFS::close()
 {
+	if (m_markPending)
+		flush();
 	m_openFile = -1;
 	m_filePos = 0;
 }
@@ -237,7 +529,7 @@ void FlashFS::close()
 #ifndef FS_USE_SEPARATE_FILE
 bool FlashFS::eof() const
 {
-	return (m_openFile < 0) || (m_filePos >= m_dir.files[m_openFile].size);
+	return (m_openFile < 0) || (m_filePos >= entry(m_openFile).size);
 }
 #endif
 
@@ -248,7 +540,7 @@ uint32_t FlashFS::setPos(int32_t pos)
 		latchError(ERROR_FILE_NOT_OPENED);
 	else if (pos < 0)
 		latchError(ERROR_POSITION_NEGATIVE);
-	else if (uint32_t(pos) < m_dir.files[m_openFile].size)
+	else if (uint32_t(pos) < entry(m_openFile).size)
 		m_filePos = uint32_t(pos);
 	else
 		latchError(ERROR_POSITION_BEYOND_EOF);
@@ -271,19 +563,37 @@ int FlashFS::write(const void* data, uint32_t size)
 		return latchError(ERROR_FILE_NOT_OPENED);		// closed
 
 	// check available space
-	if (m_filePos + size > m_dir.files[m_openFile].size)
+	if (m_filePos + size > entry(m_openFile).size)
 		return latchError(ERROR_WRITING_BEYOND_EOF);	// not enough space
 
 	if (size == 0)
 		return latchError(0);
 
-	uint32_t addr = m_dir.files[m_openFile].startAddress + m_filePos;
+	const FileEntry current = entry(m_openFile);
+	uint32_t addr = current.startAddress + m_filePos;
 	
 	if (m_dbgEnable)
 		Serial.println("flashing data...");
 	
+	if (m_filePos + size > current.written)
+		deviceDiscard(current.startAddress + current.written
+					, pageAlign(current.startAddress + current.size, true));
+	// a gap behind the high-water mark must become real fill data
+	m_writeFailed = false;
+	if (m_filePos > current.written)
+		writePattern(current.startAddress + current.written, current.written
+					, m_filePos - current.written, current.fillWord);
 	write(addr, reinterpret_cast<const char*>(data), size);
+	if (m_writeFailed)
+		return latchError(ERROR_DEVICE_WRITE);
 	m_filePos += size;
+	if (m_filePos > current.written)
+	{
+		FileEntry update = current;		// recorded by flush() or close()
+		update.written = m_filePos;
+		storeEntry(m_openFile, update);
+		m_markPending = true;
+	}
 	return latchError(size);
 }
 #endif
@@ -295,14 +605,20 @@ int FlashFS::read(void* data, uint32_t size)
 		return latchError(ERROR_FILE_NOT_OPENED);		// closed
 
 	// check available space
-	if (m_filePos + size > m_dir.files[m_openFile].size)
+	if (m_filePos + size > entry(m_openFile).size)
 		return latchError(ERROR_READING_BEYOND_EOF);	// not enough space
 
 	if (size == 0)
 		return latchError(0);
 
-	uint32_t addr = m_dir.files[m_openFile].startAddress + m_filePos;
-	read(addr, reinterpret_cast<char*>(data), size);
+	const FileEntry current = entry(m_openFile);
+	uint32_t addr = current.startAddress + m_filePos;
+	uint32_t stored = (m_filePos < current.written) ? current.written - m_filePos : 0;
+	if (stored > size)
+		stored = size;
+	read(addr, reinterpret_cast<char*>(data), stored);
+	fillPattern(reinterpret_cast<char*>(data) + stored
+			  , m_filePos + stored, size - stored, current.fillWord);
 	m_filePos += size;
 	return latchError(size);
 }
@@ -322,11 +638,34 @@ int FlashFS::latchError(int val) const
 int FlashFS::findFile(const char* fileName) const
 {
 	for(int i = 0; uint32_t(i) < m_dir.numFiles; ++i)
-		if(strncmp(fileName, m_dir.files[i].name, 8) == 0)
+		if(strncmp(fileName, entry(i).name, MAXNAMELEN) == 0)
 			return i;
 	return ERROR_FILE_NOT_FOUND;
 }
 
+uint8_t FlashFS::collectExtents(Extent* extents) const
+{
+	// the directory is not ordered by address (a committed update just 
+	// changes the startAddress), so sort the files and a pending shadow.
+	uint8_t count = 0;
+	for(int i = 0; i <= int(m_dir.numFiles); ++i)
+	{
+		const FileEntry& current = (i < int(m_dir.numFiles)) ? entry(i) : m_shadow;
+		if (current.startAddress == 0)
+			continue;	// no pending shadow
+
+		// even empty files own a page, thus start addresses stay unique
+		const uint32_t size = (current.size > 0) ? current.size : 1;
+		Extent extent = { current.startAddress
+						, pageAlign(current.startAddress + size, true) };
+		uint8_t pos = count++;
+		for(; (pos > 0) && (extents[pos-1].start > extent.start); --pos)
+			extents[pos] = extents[pos-1];
+		extents[pos] = extent;
+	}
+	return count;
+}
+
 FlashFS::GapInfo FlashFS::findBestFittingGap(uint32_t size) const
 {
 	// looking for smallest gap, large enough to hold the requested size
@@ -334,65 +673,693 @@ FlashFS::GapInfo FlashFS::findBestFittingGap(uint32_t size) const
 	//	[DIR] <-----> [FILE1] <---> [FILE2] <----------> [FILE3] <---.....----> [END]
 	//	         7              5                12                    1000
 	// looking for gap to hold size 4 should return the gap between FILE1 and FILE2.
+	// New entries are appended to the directory.
 	//
+	Extent extents[MAXFILEENTRIES + 1];
+	const uint8_t count = collectExtents(extents);
+
 	GapInfo bestFit = {ERROR_NOT_ENOUGH_SPACE, 0, 0};
-	for(int insertAt = 0; insertAt <= int(m_dir.numFiles); ++insertAt)
+	uint32_t startSegment = pageAlign(sizeof(Directory), true);	// in front of [FILE1]
+	for(uint8_t i = 0; i <= count; ++i)
 	{
-		const uint32_t startSegment = (insertAt == 0)
-			? pageAlign(sizeof(Directory), true)	// in front of [FILE1]
-			: pageAlign(m_dir.files[insertAt-1].startAddress 
-			          + m_dir.files[insertAt-1].size, true);
-
-		const uint32_t endSegment = (insertAt == int(m_dir.numFiles))
+		const uint32_t endSegment = (i == count)
 			? m_deviceSize							// up to [END]
-			: m_dir.files[insertAt].startAddress;	// is page aligned
+			: extents[i].start;						// is page aligned
 
 		const uint32_t gapSize = endSegment - startSegment;
-		if (gapSize < size)
-			continue;
-
-		if ((bestFit.insertAt < 0) || (gapSize < bestFit.gapSize))
+		if (   (gapSize >= ((size > 0) ? size : 1))
+			&& ((bestFit.insertAt < 0) || (gapSize < bestFit.gapSize)))
 		{
-			bestFit.insertAt     = insertAt;
+			bestFit.insertAt     = int(m_dir.numFiles);
 			bestFit.startAddress = startSegment;
 			bestFit.gapSize      = gapSize; 
 		}
+		if (i < count)
+			startSegment = extents[i].end;
 	}
 	return bestFit;
 }
 
+#ifndef FS_STATIC_DEVICE_SIZE
+uint32_t FlashFS::pageOffset(uint32_t address) const
+{
+	return address % m_pageSize;
+}
+
 uint32_t FlashFS::pageAlign(uint32_t address, bool upwards) const
 {
-	const uint32_t offsetInPage = address % m_pageSize;
+	const uint32_t offsetInPage = pageOffset(address);
 	if (upwards & (offsetInPage > 0))
 		return address - offsetInPage + m_pageSize;
 	else
 		return address - offsetInPage;
 }
+#endif
+
+uint32_t FlashFS::probeDeviceSize()
+{
+	// up to 64k the address wraps around at the device size: the probe byte
+	// seems to appear again at probe + size.
+	m_deviceSize = EEPROMSize64k;	// plain two address bytes while probing
+	const uint32_t probe = offsetof(DirHeader, reserved);
+	char original;
+	read(probe, &original, 1);
+	for (uint32_t size = EEPROMSize4k; size < EEPROMSize64k; size <<= 1)
+	{
+		char mirror;
+		read(probe + size, &mirror, 1);
+		if (mirror != original)
+			continue;		// a different cell, device is larger
+
+		const char modified = ~original;
+		write(probe, &modified, 1);
+		read(probe + size, &mirror, 1);
+		write(probe, &original, 1);
+		if (mirror == modified)
+			return size;
+	}
+
+	// beyond 64k, P0 and P1 of the device address select the upper blocks.
+	// Another EEPROM may acknowledge there as well, thus each block has to
+	// continue the one below.
+	m_deviceSize = EEPROMSize256k;
+	if (!acknowledges(m_deviceAddress | 0x01) || !continuesInto(EEPROMSize64k))
+		return EEPROMSize64k;
+	if (!acknowledges(m_deviceAddress | 0x02) || !continuesInto(EEPROMSize128k))
+		return EEPROMSize128k;
+	return EEPROMSize256k;
+}
+
+bool FlashFS::continuesInto(uint32_t blockStart)
+{
+	// a sequential read rolls over from the last byte below into the block,
+	// if both are part of the same device. Modifying the first byte rules 
+	// out an equal value by chance, the block below must not mirror it.
+	const uint32_t below = blockStart - EEPROMSize64k;
+	char original, base, mirror;
+	char across[2];
+	read(blockStart, &original, 1);
+	read(below, &base, 1);
+	read(blockStart - 1, across, 2);
+	if (across[1] != original)
+		return false;
+
+	const char modified = ~original;
+	write(blockStart, &modified, 1);
+	read(blockStart - 1, across, 2);
+	read(below, &mirror, 1);
+	write(blockStart, &original, 1);
+	return (across[1] == modified) && (mirror == base);
+}
+
+uint16_t FlashFS::probePageSize()
+{
+	// writing two bytes across an assumed page boundary: if the second byte
+	// wraps around to the start of the page, the page size is found. Probing
+	// in the last 256 bytes, the first byte is written unchanged and the 
+	// second one is restored afterwards.
+	const uint32_t scratch = m_deviceSize - 256;
+	m_pageSize = 512;		// don't let write() split the probes
+	for (uint16_t candidate = 8; candidate < 256; candidate <<= 1)
+	{
+		char saved[3];
+		read(scratch, saved, 1);
+		read(scratch + candidate - 1, saved + 1, 2);
+
+		const char probe[2] = { saved[1], char(~saved[2]) };
+		write(scratch + candidate - 1, probe, 2);
+		char check;
+		read(scratch + candidate, &check, 1);
+		if (check != probe[1])
+		{
+			write(scratch, saved, 1);	// wrapped around to the page start
+			return candidate;
+		}
+		write(scratch + candidate, saved + 2, 1);
+	}
+	return 256;
+}
+
+bool FlashFS::acknowledges(uint8_t devAddress) const
+{
+	// setting the address only, doesn't write
+	Wire.beginTransmission(devAddress);
+	Wire.write(0);
+	Wire.write(0);
+	return Wire.endTransmission() == 0;
+}
+
+void FlashFS::copyData(uint32_t from, uint32_t to, uint32_t size)
+{
+	// copying upwards page by page, thus every chunk is written with a 
+	// single page write and moving down into an overlapping area is safe.
+	unique_ptr<char, _array_destructor> temp = new char[m_pageSize];
+	deviceDiscard(to, pageAlign(to + size, true));
+	while (size > 0)
+	{
+		uint32_t chunkSize = m_pageSize - pageOffset(to);
+		if (chunkSize > size)
+			chunkSize = size;
+		read(from, temp.get(), chunkSize);
+		write(to, temp.get(), chunkSize);
+
+		from += chunkSize;
+		to	 += chunkSize;
+		size -= chunkSize;
+	}
+}
 
 void FlashFS::insertFilesEntry(int atIdx)
 {
 	for(int i = int(m_dir.numFiles) - 1; i >= atIdx; --i)
-		m_dir.files[i+1] = m_dir.files[i];
+		storeEntry(i+1, FileEntry(entry(i)));
 	++m_dir.numFiles;
 }
 
 void FlashFS::removeFilesEntry(int atIdx)
 {
 	for (int i = atIdx; uint32_t(i) < m_dir.numFiles - 1; ++i)
-		m_dir.files[i] = m_dir.files[i+1];
+		storeEntry(i, FileEntry(entry(i+1)));
 	--m_dir.numFiles;
 }
 
+#ifdef FS_TRACE
+void FlashFS::traceStart()
+{
+	const uint8_t op = TRACE_START;
+	TraceStart start;
+	start.deviceSize = m_deviceSize;
+	start.version = FILESYSTEMVERSION;
+	start.pageSize = m_pageSize;
+	start.dirSize = sizeof(DirHeader) + m_dir.numFiles * sizeof(FileEntry);
+	start.reserved = 0;
+	traceOut(&op, 1);
+	traceOut(&start, sizeof(start));
+	traceOut(static_cast<const DirHeader*>(&m_dir), sizeof(DirHeader));
+	for(int i = 0; uint32_t(i) < m_dir.numFiles; ++i)
+		traceOut(&entry(i), sizeof(FileEntry));
+}
+
+void FlashFS::trace(uint8_t op, const void* payload, uint8_t size)
+{
+	if (   m_tracePage
+		&& (m_traceAddress + m_traceFill + 1 + size > m_traceEnd))
+		stopTrace();		// full, records are never truncated
+	if (!m_traceOut && !m_tracePage)
+		return;
+
+	traceOut(&op, 1);
+	traceOut(payload, size);
+}
+
+void FlashFS::traceName(uint8_t op, const char* name, uint32_t size, uint32_t address)
+{
+	TraceName record;
+	record.size = size;
+	record.address = address;
+	strncpy(record.name, name, MAXNAMELEN);
+	record.name[MAXNAMELEN] = '\0';
+	record.reserved[0] = record.reserved[1] = 0;
+	trace(op, &record, sizeof(record));
+}
+
+void FlashFS::traceData(uint8_t op, uint32_t address, uint32_t pos, uint32_t arg)
+{
+	const TraceData record = { address, pos, arg };
+	trace(op, &record, sizeof(record));
+}
+
+void FlashFS::traceOut(const void* data, uint16_t size)
+{
+	if (m_traceOut != nullptr)
+	{
+		m_traceOut->write(reinterpret_cast<const uint8_t*>(data), size);
+		return;
+	}
+
+	// collecting pages of the trace file, like restoreData()
+	const char* from = reinterpret_cast<const char*>(data);
+	while (size > 0)
+	{
+		uint16_t chunkSize = m_pageSize - m_traceFill;
+		if (chunkSize > size)
+			chunkSize = size;
+		memcpy(m_tracePage.get() + m_traceFill, from, chunkSize);
+		m_traceFill += chunkSize;
+		from += chunkSize;
+		size -= chunkSize;
+
+		if (m_traceFill == m_pageSize)
+		{
+			write(m_traceAddress, m_tracePage.get(), m_pageSize);
+			m_traceAddress += m_pageSize;
+			m_traceFill = 0;
+		}
+	}
+}
+#endif
+
+void FlashFS::fillPattern(char* data, uint32_t filePos, uint32_t size, uint32_t fillWord)
+{
+	// the pattern is aligned to the start of the file, as if the fillWord
+	// had been written as uint32_t array.
+	const char* pattern = reinterpret_cast<const char*>(&fillWord);
+	for (uint32_t i = 0; i < size; ++i)
+		data[i] = pattern[(filePos + i) % sizeof(uint32_t)];
+}
+
+void FlashFS::writePattern(uint32_t address, uint32_t filePos, uint32_t size, uint32_t fillWord)
+{
+	char temp[32];
+	while (size > 0)
+	{
+		uint32_t chunkSize = size;
+		if (chunkSize > sizeof(temp))
+			chunkSize = sizeof(temp);
+		fillPattern(temp, filePos, chunkSize, fillWord);
+		write(address, temp, chunkSize);
+
+		address += chunkSize;
+		filePos += chunkSize;
+		size	-= chunkSize;
+	}
+}
+
+void FlashFS::setSparseState(int idx, uint32_t written, uint32_t fillWord)
+{
+	FileEntry update = entry(idx);
+	update.written = written;
+	update.fillWord = fillWord;
+	writeEntryHead(idx, update);	// just this entry, not the whole directory
+}
+
+const FlashFS::FileEntry& FlashFS::entry(int idx) const
+{
+#ifndef FS_LITE_DIRECTORY
+	return m_dir.files[idx];
+#else
+	return cacheSlot(idx).entry;
+#endif
+}
+
+void FlashFS::storeEntry(int idx, const FileEntry& fileEntry)
+{
+#ifndef FS_LITE_DIRECTORY
+	m_dir.files[idx] = fileEntry;
+#else
+	CacheSlot& slot = cacheSlot(idx);
+	slot.entry = fileEntry;
+	slot.dirty = true;	// written back by writeDirectory() or eviction
+#endif
+}
+
+#ifdef FS_LITE_DIRECTORY
+FlashFS::CacheSlot& FlashFS::cacheSlot(int idx) const
+{
+	// LRU: a hit or a load makes the slot the youngest, all others age.
+	CacheSlot* hit = nullptr;
+	CacheSlot* oldest = m_cache;
+	for(CacheSlot& slot : m_cache)
+	{
+		if (slot.idx == idx)
+			hit = &slot;
+		if (   (oldest->idx >= 0)
+			&& ((slot.idx < 0) || (slot.age > oldest->age)))
+			oldest = &slot;
+	}
+
+	uint8_t hitAge = 0xFF;	// a loaded slot is younger than all others
+	if (hit == nullptr)
+	{
+		hit = oldest;
+		writeBackSlot(*hit);
+		read(sizeof(DirHeader) + idx * sizeof(FileEntry)
+			, reinterpret_cast<char*>(&hit->entry), sizeof(FileEntry));
+		hit->idx = idx;
+	}
+	else
+		hitAge = hit->age;
+
+	for(CacheSlot& slot : m_cache)
+		if (slot.age < hitAge)
+			++slot.age;
+	hit->age = 0;
+	return *hit;
+}
+
+void FlashFS::writeBackSlot(CacheSlot& slot) const
+{
+	if (!slot.dirty)
+		return;
+
+	// flushing the cache doesn't change the logical state of the directory.
+	const_cast<FlashFS*>(this)->write(sizeof(DirHeader) + slot.idx * sizeof(FileEntry)
+		, reinterpret_cast<const char*>(&slot.entry), sizeof(FileEntry));
+	slot.dirty = false;
+}
+
+void FlashFS::clearCache()
+{
+	for(CacheSlot& slot : m_cache)
+	{
+		slot.idx = -1;
+		slot.age = 0;
+		slot.dirty = false;
+	}
+}
+#endif
+
+void FlashFS::beginBatch()
+{
+#ifdef FS_TRACE
+	trace(TRACE_BATCH, nullptr, 0);
+#endif
+	++m_batchDepth;
+}
+
+void FlashFS::commitBatch()
+{
+	if (m_batchDepth == 0)
+		return;
+#ifdef FS_TRACE
+	trace(TRACE_COMMITBATCH, nullptr, 0);
+#endif
+	if ((--m_batchDepth == 0) && m_batchPending)
+	{
+		m_batchPending = false;
+		writeDirectory();
+	}
+}
+
+int FlashFS::beginRestore(uint32_t imageSize)
+{
+	if (imageSize > m_deviceSize)
+		return latchError(ERROR_NOT_ENOUGH_SPACE);
+
+#ifndef FS_USE_SEPARATE_FILE
+	m_markPending = false;			// the image replaces the directory
+	close();
+#else
+	m_openFile = -1;
+#endif
+	m_shadow.startAddress = 0;
+	m_batchDepth = 0;
+	m_batchPending = false;
+#ifdef FS_PIN_BUDGET
+	dropPins();
+#endif
+	m_restorePage = new char[m_pageSize];
+	deviceDiscard(0, pageAlign(imageSize, true));
+	m_restoreAddress = 0;
+	m_restoreSize = imageSize;
+	m_restoreFill = 0;
+	return latchError(ERROR_NONE);
+}
+
+int FlashFS::restoreData(const void* data, uint32_t size)
+{
+	if (!m_restorePage)
+		return latchError(ERROR_NO_RESTORE);
+	if (m_restoreAddress + m_restoreFill + size > m_restoreSize)
+		return latchError(ERROR_WRITING_BEYOND_EOF);
+
+	// collecting full pages, thus each page is programmed once
+	const char* from = reinterpret_cast<const char*>(data);
+	for (uint32_t left = size; left > 0; )
+	{
+		uint32_t chunkSize = m_pageSize - m_restoreFill;
+		if (chunkSize > left)
+			chunkSize = left;
+		memcpy(m_restorePage.get() + m_restoreFill, from, chunkSize);
+		m_restoreFill += chunkSize;
+		from += chunkSize;
+		left -= chunkSize;
+
+		if (m_restoreFill == m_pageSize)
+		{
+			write(m_restoreAddress, m_restorePage.get(), m_pageSize);
+			m_restoreAddress += m_pageSize;
+			m_restoreFill = 0;
+		}
+	}
+	return latchError(int(size));
+}
+
+bool FlashFS::endRestore()
+{
+	if (!m_restorePage)
+	{
+		latchError(ERROR_NO_RESTORE);
+		return false;
+	}
+	if (m_restoreFill > 0)
+		write(m_restoreAddress, m_restorePage.get(), m_restoreFill);
+	m_restorePage.reset();
+	return openDevice();
+}
+
+#ifdef FS_PIN_BUDGET
+int FlashFS::pin(const char* fileName)
+{
+	const int idx = findFile(fileName);
+	if (idx < 0)
+		return latchError(ERROR_FILE_NOT_FOUND);
+
+	const uint32_t startAddress = entry(idx).startAddress;
+	const uint32_t size = entry(idx).size;
+#ifdef FS_TRACE
+	traceName(TRACE_PIN, fileName, size, startAddress);
+#endif
+	dropPin(startAddress);
+	return latchError(loadPin(startAddress, size));
+}
+
+int FlashFS::unpin(const char* fileName)
+{
+	const int idx = findFile(fileName);
+	if (idx < 0)
+		return latchError(ERROR_FILE_NOT_FOUND);
+
+#ifdef FS_TRACE
+	traceName(TRACE_UNPIN, fileName, 0, entry(idx).startAddress);
+#endif
+	dropPin(entry(idx).startAddress);
+	return latchError(ERROR_NONE);
+}
+
+uint32_t FlashFS::pinnedBytes() const
+{
+	uint32_t bytes = 0;
+	for (const Pin& pin : m_pins)
+		if (pin.startAddress != 0)
+			bytes += pin.size;
+	return bytes;
+}
+
+int FlashFS::loadPin(uint32_t startAddress, uint32_t size)
+{
+	Pin* slot = nullptr;
+	for (Pin& pin : m_pins)
+		if (pin.startAddress == 0)
+			slot = &pin;
+	if ((slot == nullptr) || (pinnedBytes() + size > FS_PIN_BUDGET))
+		return ERROR_PIN_BUDGET;
+
+	// the whole extent, thus the copy mirrors the device byte by byte
+	slot->data = new char[size > 0 ? size : 1];
+	read(startAddress, slot->data.get(), size);
+	slot->startAddress = startAddress;
+	slot->size = size;
+	return int(size);
+}
+
+bool FlashFS::dropPin(uint32_t startAddress)
+{
+	for (Pin& pin : m_pins)
+		if (pin.startAddress == startAddress)
+		{
+			pin.startAddress = 0;
+			pin.data.reset();
+			return true;
+		}
+	return false;
+}
+
+void FlashFS::dropPins()
+{
+	for (Pin& pin : m_pins)
+	{
+		pin.startAddress = 0;
+		pin.data.reset();
+	}
+}
+
+void FlashFS::reloadPin(uint32_t oldStart, const char* fileName)
+{
+	// moved or resized: loaded again from its current extent
+	if (!dropPin(oldStart))
+		return;
+	const int idx = findFile(fileName);
+	if (idx >= 0)
+		loadPin(entry(idx).startAddress, entry(idx).size);
+}
+
+bool FlashFS::readPinned(uint32_t address, char* data, uint32_t size) const
+{
+	for (const Pin& pin : m_pins)
+		if (   (pin.startAddress != 0)
+			&& (address >= pin.startAddress)
+			&& (address + size <= pin.startAddress + pin.size))
+		{
+			memcpy(data, pin.data.get() + (address - pin.startAddress), size);
+			return true;
+		}
+	return false;
+}
+
+void FlashFS::writePinned(uint32_t address, const char* data, uint32_t size)
+{
+	// write-through: the device is written already, the copies follow
+	for (Pin& pin : m_pins)
+	{
+		if (   (pin.startAddress == 0)
+			|| (address >= pin.startAddress + pin.size)
+			|| (address + size <= pin.startAddress))
+			continue;
+		const uint32_t from = (address > pin.startAddress) ? address : pin.startAddress;
+		const uint32_t to = (address + size < pin.startAddress + pin.size)
+						  ? address + size : pin.startAddress + pin.size;
+		memcpy(pin.data.get() + (from - pin.startAddress), data + (from - address), to - from);
+	}
+}
+#endif
+
+#ifdef FS_TRACE
+void FlashFS::startTrace(Print& out)
+{
+	stopTrace();
+	m_traceOut = &out;
+	traceStart();
+}
+
+int FlashFS::startTrace(const char* fileName)
+{
+	stopTrace();
+	const int idx = findFile(fileName);
+	if (idx < 0)
+		return latchError(ERROR_FILE_NOT_FOUND);
+
+	const FileEntry& traceFile = entry(idx);
+	if (1 + sizeof(TraceStart) + sizeof(Directory) > traceFile.size)
+		return latchError(ERROR_NOT_ENOUGH_SPACE);
+	m_traceStart = traceFile.startAddress;
+	m_traceAddress = m_traceStart;		// page aligned
+	m_traceEnd = m_traceStart + traceFile.size;
+	m_traceFill = 0;
+	m_tracePage = new char[m_pageSize];
+	deviceDiscard(m_traceStart, pageAlign(m_traceEnd, true));
+	traceStart();
+	return latchError(ERROR_NONE);
+}
+
+void FlashFS::stopTrace()
+{
+	m_traceOut = nullptr;
+	if (!m_tracePage)
+		return;
+
+	if (m_traceFill > 0)
+		write(m_traceAddress, m_tracePage.get(), m_traceFill);
+	m_traceAddress += m_traceFill;
+	m_tracePage.reset();
+	for(int i = 0; uint32_t(i) < m_dir.numFiles; ++i)
+		if (entry(i).startAddress == m_traceStart)
+			setSparseState(i, m_traceAddress - m_traceStart, entry(i).fillWord);
+}
+#endif
+
+
 void FlashFS::writeDirectory()
 {
+	if (m_batchDepth > 0)
+	{
+		m_batchPending = true;		// by commitBatch()
+		return;
+	}
+
 	if (m_dbgEnable)
 		Serial.println("flashing dir...");
 	
+#ifdef FS_LITE_DIRECTORY
+	for(CacheSlot& slot : m_cache)
+		writeBackSlot(slot);
+#endif
 	write(0x0, reinterpret_cast<const char*>(&m_dir), sizeof(m_dir));
 }
 
-uint8_t FlashFS::beginAndWriteAddress(uint32_t address)
+void FlashFS::writeEntryHead(int idx, const FileEntry& fileEntry)
+{
+	// entries are 32 bytes aligned, thus the head is written by a single
+	// transaction for pages of 16 bytes and up.
+	if (m_batchDepth > 0)
+	{
+		storeEntry(idx, fileEntry);	// the index may differ on the EEPROM
+		m_batchPending = true;
+		return;
+	}
+#ifdef FS_LITE_DIRECTORY
+	CacheSlot& slot = cacheSlot(idx);
+	const bool dirty = slot.dirty;
+	storeEntry(idx, fileEntry);
+	slot.dirty = dirty;		// the tail is unchanged
+#else
+	storeEntry(idx, fileEntry);
+#endif
+	write(sizeof(DirHeader) + idx * sizeof(FileEntry)
+		, reinterpret_cast<const char*>(&fileEntry), offsetof(FileEntry, name));
+}
+
+#ifdef FS_TWI_PAGE_WRITE
+// Blocking TWI master transmitter, used for page writes only. Wire's 
+// interrupt driven state machine is idle in between its calls, so the TWI 
+// registers may be used directly, as long as TWIE stays off meanwhile.
+static bool twiWait()
+{
+	for (uint16_t timeout = 0xFFFF; timeout > 0; --timeout)
+		if (TWCR & _BV(TWINT))
+			return true;
+	return false;
+}
+
+static bool twiTransmit(uint8_t data, uint8_t expectedStatus)
+{
+	TWDR = data;
+	TWCR = _BV(TWINT) | _BV(TWEN);
+	return twiWait() && (TW_STATUS == expectedStatus);
+}
+
+static bool twiWritePage(uint8_t devAddress, uint32_t address, uint8_t addressBytes
+					   , const char* data, uint32_t size)
+{
+	TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+	bool ok = twiWait() && (TW_STATUS == TW_START)
+		   && twiTransmit((devAddress << 1) | TW_WRITE, TW_MT_SLA_ACK);
+	while (ok && (addressBytes-- > 0))
+		ok = twiTransmit((address >> (8 * addressBytes)) & 0x0FF, TW_MT_DATA_ACK);
+	for (uint32_t i = 0; ok && (i < size); ++i)
+		ok = twiTransmit(data[i], TW_MT_DATA_ACK);
+
+	TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+	uint16_t timeout = 0xFFFF;
+	while ((TWCR & _BV(TWSTO)) && (--timeout > 0))
+		;
+	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);	// hand back to Wire
+	return ok && (timeout > 0);
+}
+#endif
+
+#ifndef FS_STATIC_DEVICE_SIZE
+uint8_t FlashFS::deviceAddress(uint32_t address) const
 {
 	uint8_t modifiedDevAddress = m_deviceAddress;
 
@@ -428,7 +1395,7 @@ uint8_t FlashFS::beginAndWriteAddress(uint32_t address)
 
 	case EEPROMSize32M:		// using P0					???
 		modifiedDevAddress &= ~ 0x01;
-		modifiedDevAddress |= (address >> 16) & 0x01;
+		modifiedDevAddress |= (address >> 24) & 0x01;
 		break;
 	case EEPROMSize64M:		// using P0, P1				???
 		modifiedDevAddress &= ~ 0x03;
@@ -440,34 +1407,53 @@ uint8_t FlashFS::beginAndWriteAddress(uint32_t address)
 		break;
 #endif
 	}
+	return modifiedDevAddress;
+}
 
-	Wire.beginTransmission(modifiedDevAddress);
-	// now all remaining address bytes, MSB to LSB: 
+uint8_t FlashFS::addressBytes() const
+{
+	uint8_t bytes = 1;
 #ifdef FLASHFS_SUPPORT_FOR_HIGHCAPACITY
 	if (m_deviceSize > EEPROMSize128M)
-		Wire.write((int)(address >> 24)	& 0x0FF));
+		++bytes;
 	if (m_deviceSize > EEPROMSize512k)
-		Wire.write((int)(address >> 16)	& 0x0FF));
+		++bytes;
 #endif
 	if (m_deviceSize > EEPROMSize2k)
-		Wire.write((int)(address >> 8)	& 0x0FF);	
-	Wire.write((int)(address)		& 0x0FF);
+		++bytes;
+	return bytes;
+}
+#endif
+
+uint8_t FlashFS::beginAndWriteAddress(uint32_t address) const
+{
+	const uint8_t modifiedDevAddress = deviceAddress(address);
+
+	Wire.beginTransmission(modifiedDevAddress);
+	// now all remaining address bytes, MSB to LSB: 
+	for (uint8_t i = addressBytes(); i > 0; --i)
+		Wire.write((int)(address >> (8 * (i - 1))) & 0x0FF);
 
 	return modifiedDevAddress;
 }
 
-void FlashFS::write(uint32_t address, const char* data, uint32_t size)
+bool FlashFS::deviceWrite(uint32_t address, const char* data, uint32_t size)
 {
 	// keep in mind: 
 	//	- don't write blocks crossing page boundaries
 	//  - don't write blocks larger than arduinos Wire-lib supports
+#ifdef FS_TWI_PAGE_WRITE
+	const uint32_t maxChunkSize = m_pageSize;	// not limited by Wire
+#else
+	const uint32_t maxChunkSize = FS_WIRE_BUFFER_LENGTH - addressBytes();
+#endif
 	while(size > 0)
 	{
 		bool eop = false;
-		uint32_t chunkSize = BUFFER_LENGTH - 2;	// 2 bytes requireed for sending address
+		uint32_t chunkSize = maxChunkSize;
 		if (chunkSize > size)					// more than required?
 			chunkSize = size;
-		uint32_t spaceOnPage = m_pageSize - (address % m_pageSize);
+		uint32_t spaceOnPage = m_pageSize - pageOffset(address);
 		if (chunkSize > spaceOnPage)			// only up to page bounds
 		{
 			eop = true;
@@ -476,40 +1462,48 @@ void FlashFS::write(uint32_t address, const char* data, uint32_t size)
 
 		if (m_dbgEnable)
 		{
-			snprintf(_dbg_buffer, DEBUG_BUFLEN, "wr: addr 0x%06lx, size %6ld, chunk %6ld >> "
-							   , address, size, chunkSize);
+			snprintf(_dbg_buffer, DEBUG_BUFLEN, "wr: addr 0x%06lx, size %6lu, chunk %6lu >> "
+							   , (unsigned long)address, (unsigned long)size, (unsigned long)chunkSize);
 			Serial.print(_dbg_buffer);
 		}
 
+#ifdef FS_TWI_PAGE_WRITE
+		const bool ok = twiWritePage(deviceAddress(address), address, addressBytes(), data, chunkSize);
+#else
 		beginAndWriteAddress(address);
 		for (uint32_t i = 0; i < chunkSize; ++i)
-		{
 			Wire.write((int)(data[i]));
-			if (m_dbgEnable)
+		const bool ok = (Wire.endTransmission() == 0);
+#endif
+		if (m_dbgEnable)
+		{
+			for (uint32_t i = 0; i < chunkSize; ++i)
 			{
 				snprintf(_dbg_buffer, DEBUG_BUFLEN, "%02x ", data[i] & 0x0FF); 
 				Serial.print(_dbg_buffer);
 			}
 		}
-		Wire.endTransmission();
 		delay(5);	// give EEPROM time to flash the page
 		if (m_dbgEnable)
 			Serial.println(eop ? "<p>" : "");
+		if (!ok)
+			return false;	// NACK: busy, absent or write protected
 
 		// move to next chunk
 		address += chunkSize;
 		data	+= chunkSize;
 		size	-= chunkSize;
 	}
+	return true;
 }
 
-void FlashFS::read(uint32_t address, char* data, uint32_t size)
+void FlashFS::deviceRead(uint32_t address, char* data, uint32_t size) const
 {
 	// keep in mind: 
 	//  - don't read blocks larger than arduinos Wire-lib supports
 	while(size > 0)
 	{
-		uint32_t chunkSize = BUFFER_LENGTH;
+		uint32_t chunkSize = FS_WIRE_BUFFER_LENGTH;
 		if (chunkSize > size)					// more than required?
 			chunkSize = size;
 		
@@ -520,8 +1514,8 @@ void FlashFS::read(uint32_t address, char* data, uint32_t size)
 		if (m_dbgEnable)
 		{
 			snprintf(_dbg_buffer, DEBUG_BUFLEN
-					, "rd: addr 0x%06lx, size %6ld, chunk %6ld << "
-					, address, size, chunkSize);
+					, "rd: addr 0x%06lx, size %6lu, chunk %6lu << "
+					, (unsigned long)address, (unsigned long)size, (unsigned long)chunkSize);
 			Serial.print(_dbg_buffer);
 		}
 
@@ -549,6 +1543,11 @@ void FlashFS::read(uint32_t address, char* data, uint32_t size)
 	}
 }
 
+void FlashFS::deviceDiscard(uint32_t, uint32_t)
+{
+	// EEPROM bytes are simply overwritten
+}
+
 // ==================================================================
 
 File::File()
@@ -560,6 +1559,10 @@ File::File(const File& other)
 	, m_address{other.m_address}
 	, m_filePos{other.m_filePos}
 	, m_fileSize{other.m_fileSize}
+	, m_written{other.m_written}
+	, m_fillWord{other.m_fillWord}
+	, m_update{false}	// the original owns the update
+	, m_markPending{false}
 {
 }
 
@@ -573,63 +1576,126 @@ File::File(const char* fileName, uint32_t size)
 	createFile(fileName, size);
 }
 
+File::~File()
+{
+	close();
+}
+
 int File::createFile(const char* fileName, uint32_t size)
 {
+	flush();
 	const auto result = flashFs.createFile(fileName, size);
 	if (result < 0)
 		return latchError(result);
 
-	const auto entry = flashFs.grantFileAccess();
-	m_address  = entry->startAddress;
-	m_fileSize = entry->size;
+	assign(flashFs.grantFileAccess());
+#ifdef FS_TRACE
+	flashFs.traceName(FlashFS::TRACE_CREATE, fileName, size, m_address);
+#endif
 	return latchError(result);
 }
 
 int File::openFile(const char* fileName)
 {
+	flush();
 	const auto result = flashFs.openFile(fileName);
 	if (result < 0)
 		return latchError(result);
 	
-	const auto entry = flashFs.grantFileAccess();
-	m_address  = entry->startAddress;
-	m_fileSize = entry->size;
+	assign(flashFs.grantFileAccess());
+#ifdef FS_TRACE
+	flashFs.traceName(FlashFS::TRACE_OPEN, fileName, m_fileSize, m_address);
+#endif
+	return latchError(result);
+}
+
+int File::beginUpdate(const char* fileName, uint32_t size)
+{
+	close();
+	const auto shadow = flashFs.reserveShadow(fileName, size);
+	if (shadow == nullptr)
+		return latchError(flashFs.lastError());
+
+	assign(shadow);
+	m_update = true;
+#ifdef FS_TRACE
+	flashFs.traceName(FlashFS::TRACE_UPDATE, fileName, size, m_address);
+#endif
+	return latchError(int(m_fileSize));
+}
+
+int File::commitUpdate()
+{
+	if (!m_update)
+		return latchError(FlashFS::ERROR_NO_UPDATE);
+
+#ifdef FS_TRACE
+	trace(FlashFS::TRACE_COMMIT, 0, 0);
+#endif
+	m_update = false;
+	const auto result = flashFs.commitShadow(m_address, m_written, m_fillWord);
+	if (result < 0)
+		close();
 	return latchError(result);
 }
 
 int File::cleanFile(uint32_t fillWord)
 {
 	if (m_address == 0x0)
-		latchError(FlashFS::ERROR_FILE_NOT_OPENED);
-
-	const int tempSize = flashFs.pageSize() / sizeof(uint32_t);
-	unique_ptr<uint32_t, _array_destructor> temp = new uint32_t[tempSize];
-	for(int i = 0; i < tempSize; ++i)
-		temp[i] = fillWord;
-	
-	const uint32_t restorePos = pos();
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
 
-	setPos(0);
-	uint32_t bytesToWrite = m_fileSize;
-	while (bytesToWrite > 0)
-	{
-		uint32_t chunkSize = bytesToWrite;
-		if (chunkSize > tempSize * sizeof(uint32_t))
-			chunkSize = tempSize * sizeof(uint32_t);
-		write(temp.get(), chunkSize);
-		bytesToWrite -= chunkSize;
-	}
+#ifdef FS_TRACE
+	trace(FlashFS::TRACE_CLEAN, 0, fillWord);
+#endif
+	const auto result = m_update 
+		? FlashFS::ERROR_NONE
+		: flashFs.updateSparseState(m_address, 0, fillWord);
+	if (result < 0)
+		return latchError(result);
 
-	// cleanup:
-	setPos(restorePos);
+	m_markPending = false;
+	m_written  = 0;
+	m_fillWord = fillWord;
 	return latchError(m_fileSize);
 }
 
+int File::flush()
+{
+	if (m_address == 0x0)
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
+	if (!m_markPending)
+		return latchError(FlashFS::ERROR_NONE);
+
+#ifdef FS_TRACE
+	trace(FlashFS::TRACE_FLUSH, 0, 0);
+#endif
+	m_markPending = false;
+	const auto entry = flashFs.fileEntryAt(m_address);	// latest of all Files
+	if (entry == nullptr)
+		return latchError(FlashFS::ERROR_FILE_NOT_FOUND);
+	const int result = flashFs.updateSparseState(m_address, entry->written, entry->fillWord);
+	m_markPending = (result == FlashFS::ERROR_DEVICE_WRITE);	// retried by the next flush()
+	return latchError(result);
+}
+
 void File::close()
 {
+	if (m_update)
+	{
+#ifdef FS_TRACE
+		trace(FlashFS::TRACE_ABORT, 0, 0);
+#endif
+		flashFs.releaseShadow(m_address);	// aborting the update
+	}
+	else if (m_markPending)
+		flush();
+	m_update = false;
+	m_markPending = false;
 	m_address = 0x0;
 	m_filePos = 0x0;
 	m_fileSize = 0x0;
+	m_written = 0x0;
+	m_fillWord = 0x0;
 	latchError(FlashFS::ERROR_NONE);
 }
 
@@ -661,6 +1727,21 @@ uint32_t File::movePos(int32_t offset)
 
 // generic: write block of data to sequential file
 int File::write(const void* data, uint32_t size)
+{
+#ifdef FS_TRACE
+	trace(FlashFS::TRACE_WRITE, m_filePos, size);
+#endif
+	if (m_filePos + size > m_written)
+		syncSparseState();	// another File may have written meanwhile
+
+	const uint32_t written = m_written;
+	const int result = writeData(data, size);
+	if ((result > 0) && (m_written != written) && !m_update)	// committed along with the update
+		markWritten();
+	return result;
+}
+
+int File::writeData(const void* data, uint32_t size)
 {
 	if (m_address == 0x0)
 		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);		// closed
@@ -672,14 +1753,33 @@ int File::write(const void* data, uint32_t size)
 	if (size == 0)
 		return latchError(0);
 
+	if (m_filePos + size > m_written)
+		flashFs.deviceDiscard(m_address + m_written
+							, flashFs.pageAlign(m_address + m_fileSize, true));
+	// a gap behind the high-water mark must become real fill data: the only
+	// case a write costs more than the pages of the data itself
+	flashFs.m_writeFailed = false;
+	if (m_filePos > m_written)
+		flashFs.writePattern(m_address + m_written, m_written
+						   , m_filePos - m_written, m_fillWord);
+
 	uint32_t addr = m_address + m_filePos;
 	flashFs.write(addr, reinterpret_cast<const char*>(data), size);
+	if (flashFs.m_writeFailed)
+		return latchError(FlashFS::ERROR_DEVICE_WRITE);	// position and mark unchanged
+
+	m_filePos += size;
+	if (m_filePos > m_written)
+		m_written = m_filePos;
 	return latchError(size);
 }
 
 // generic: read block of data from sequential file
 int File::read(void* data, uint32_t size)
 {
+#ifdef FS_TRACE
+	trace(FlashFS::TRACE_READ, m_filePos, size);
+#endif
 	if (m_address == 0x0)
 		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);		// closed
 
@@ -690,12 +1790,206 @@ int File::read(void* data, uint32_t size)
 	if (size == 0)
 		return latchError(0);
 
+	if (m_filePos + size > m_written)
+		syncSparseState();	// another File may have written meanwhile
+
+	// only the part below the high-water mark is read from the EEPROM
 	uint32_t addr = m_address + m_filePos;
-	flashFs.read(addr, reinterpret_cast<char*>(data), size);
+	uint32_t stored = (m_filePos < m_written) ? m_written - m_filePos : 0;
+	if (stored > size)
+		stored = size;
+	flashFs.read(addr, reinterpret_cast<char*>(data), stored);
+	FlashFS::fillPattern(reinterpret_cast<char*>(data) + stored
+					   , m_filePos + stored, size - stored, m_fillWord);
 	m_filePos += size;
 	return latchError(size);
 }
 
+int32_t File::find(const void* pattern, uint16_t size, uint32_t fromPos)
+{
+	if (m_address == 0x0)
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
+	if (fromPos + size > m_fileSize)
+		return latchError(FlashFS::ERROR_PATTERN_NOT_FOUND);
+	if (size == 0)
+	{
+		latchError(FlashFS::ERROR_NONE);
+		return fromPos;
+	}
+
+	// border[i]: length of the longest proper prefix of pattern[0..i],
+	// being a suffix of it, too.
+	const char* text = reinterpret_cast<const char*>(pattern);
+	unique_ptr<uint16_t, _array_destructor> border = new uint16_t[size];
+	border[0] = 0;
+	for (uint16_t i = 1, k = 0; i < size; ++i)
+	{
+		while ((k > 0) && (text[i] != text[k]))
+			k = border[k-1];
+		if (text[i] == text[k])
+			++k;
+		border[i] = k;
+	}
+
+	const uint32_t filePos = m_filePos;
+	char chunk[FS_WIRE_BUFFER_LENGTH];
+	uint16_t matched = 0;
+	for (uint32_t pos = fromPos; pos < m_fileSize; )
+	{
+		uint32_t chunkSize = m_fileSize - pos;
+		if (chunkSize > sizeof(chunk))
+			chunkSize = sizeof(chunk);
+		m_filePos = pos;
+		const int result = read(chunk, chunkSize);
+		if (result < 0)
+		{
+			m_filePos = filePos;
+			return result;
+		}
+
+		for (uint32_t i = 0; i < chunkSize; ++i)
+		{
+			while ((matched > 0) && (chunk[i] != text[matched]))
+				matched = border[matched-1];
+			if (chunk[i] == text[matched])
+				++matched;
+			if (matched == size)
+			{
+				m_filePos = filePos;
+				latchError(FlashFS::ERROR_NONE);
+				return pos + i + 1 - size;
+			}
+		}
+		pos += chunkSize;
+	}
+	m_filePos = filePos;
+	return latchError(FlashFS::ERROR_PATTERN_NOT_FOUND);
+}
+
+void File::assign(const FlashFS::FileEntry* entry)
+{
+	m_address  = entry->startAddress;
+	m_fileSize = entry->size;
+	m_written  = entry->written;
+	m_fillWord = entry->fillWord;
+}
+
+int File::streamBegin(StreamBuffer &stream, uint32_t size)
+{
+	if (m_address == 0x0)
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
+
+	const uint16_t pageSize = flashFs.pageSize();
+	stream.capacity = (size < pageSize) ? uint16_t(size) : pageSize;
+	stream.buffer = new char[stream.capacity > 0 ? stream.capacity : 1];
+	// the first batch ends at the first page boundary, the others are pages
+	stream.limit = pageSize - (m_address + m_filePos) % pageSize;
+	if (stream.limit > stream.capacity)
+		stream.limit = stream.capacity;
+	stream.fill = 0;
+	stream.pos = 0;
+	stream.left = size;
+	syncSparseState();
+	stream.written = m_written;
+	return latchError(FlashFS::ERROR_NONE);
+}
+
+int File::streamOut(StreamBuffer &stream, const void* data, uint16_t size)
+{
+	const char* from = reinterpret_cast<const char*>(data);
+	while (size > 0)
+	{
+		uint16_t chunkSize = stream.limit - stream.fill;
+		if (chunkSize > size)
+			chunkSize = size;
+		memcpy(stream.buffer.get() + stream.fill, from, chunkSize);
+		stream.fill += chunkSize;
+		from += chunkSize;
+		size -= chunkSize;
+
+		if (stream.fill == stream.limit)
+		{
+			const int result = writeData(stream.buffer.get(), stream.fill);
+			if (result < 0)
+				return result;
+			stream.fill = 0;
+			stream.limit = stream.capacity;
+		}
+	}
+	return latchError(FlashFS::ERROR_NONE);
+}
+
+int File::streamFlush(StreamBuffer &stream)
+{
+	if (stream.fill > 0)
+	{
+		const int result = writeData(stream.buffer.get(), stream.fill);
+		if (result < 0)
+			return result;
+		stream.fill = 0;
+	}
+	// the high-water mark is recorded once for the whole stream
+	if ((m_written != stream.written) && !m_update)
+		markWritten();
+	return latchError(FlashFS::ERROR_NONE);
+}
+
+int File::streamIn(StreamBuffer &stream, void* data, uint16_t size)
+{
+	char* to = reinterpret_cast<char*>(data);
+	while (size > 0)
+	{
+		if (stream.pos == stream.fill)
+		{
+			const uint16_t fetch = (stream.left < stream.capacity) 
+								 ? uint16_t(stream.left) : stream.capacity;
+			if (fetch == 0)
+				return latchError(FlashFS::ERROR_READING_BEYOND_EOF);
+			const int result = read(stream.buffer.get(), fetch);
+			if (result < 0)
+				return result;
+			stream.left -= fetch;
+			stream.fill = fetch;
+			stream.pos = 0;
+		}
+
+		uint16_t chunkSize = stream.fill - stream.pos;
+		if (chunkSize > size)
+			chunkSize = size;
+		memcpy(to, stream.buffer.get() + stream.pos, chunkSize);
+		stream.pos += chunkSize;
+		to += chunkSize;
+		size -= chunkSize;
+	}
+	return latchError(FlashFS::ERROR_NONE);
+}
+
+void File::syncSparseState()
+{
+	if (m_update)
+		return;		// not yet known to the directory
+
+	const auto entry = flashFs.fileEntryAt(m_address);
+	if (entry == nullptr)
+		return;
+	m_written  = entry->written;
+	m_fillWord = entry->fillWord;
+}
+
+void File::markWritten()
+{
+	flashFs.updateSparseState(m_address, m_written, m_fillWord, false);
+	m_markPending = true;
+}
+
+#ifdef FS_TRACE
+void File::trace(uint8_t op, uint32_t pos, uint32_t arg)
+{
+	if (m_address != 0x0)
+		flashFs.traceData(op, m_address, pos, arg);
+}
+#endif
+
 int File::latchError(int val)
 {
 	m_lastError = (val < 0) ? val : FlashFS::ERROR_NONE;
@@ -705,4 +1999,11 @@ int File::latchError(int val)
 } // namespace
 
 // provide singleton
+#if defined(FS_NOR_DEVICE_SIZE)
+// by NorFlashFS.cpp
+#elif defined(FS_STATIC_DEVICE_SIZE)
+static om::StaticFlashFS<FS_STATIC_DEVICE_SIZE, FS_STATIC_PAGE_SIZE> _staticFlashFs(0x50);
+om::FlashFS& flashFs = _staticFlashFs;
+#else
 om::FlashFS flashFs(0x50, EEPROMSize32k, 64);
+#endif
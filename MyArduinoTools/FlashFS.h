@@ -3,20 +3,78 @@
 
 #include <stdint.h>
 
+#include "omMemory.h"
+
+class Print;
+
 namespace om {
 
+template<typename T, typename A>
+class list;
+
+namespace serialize {
+struct Field;
+}
+
 // defining FS_USE_SEPARATE_FILE extracts all file handling stuff related to its
 // content into separated class File. For backwards compatibility, where flashFs
 // was doing the stuff, comment it out.
 #define FS_USE_SEPARATE_FILE
 
+// defining FS_LITE_DIRECTORY keeps only the directory header in RAM (32 bytes
+// instead of 544). File entries are read on demand into a small LRU cache of
+// FS_DIR_CACHE_ENTRIES entries and written back by the next directory flush.
+//#define FS_LITE_DIRECTORY
+#ifndef FS_DIR_CACHE_ENTRIES
+	#define FS_DIR_CACHE_ENTRIES	4
+#endif
+
+// defining FS_PIN_BUDGET allows to pin up to FS_PIN_FILES small, hot files
+// (e.g. a config or a glyph table) into RAM copies taking FS_PIN_BUDGET bytes
+// in total: reads of pinned files are served from RAM without touching the
+// bus, writes go through to the EEPROM.
+//#define FS_PIN_BUDGET			512
+#ifndef FS_PIN_FILES
+	#define FS_PIN_FILES		2
+#endif
+
+// Wire.h limits a transmission to BUFFER_LENGTH bytes (32 on AVR and SAM),
+// thus a page write is split into several program cycles of 30 bytes. For
+// Wire implementations with a larger buffer define FS_WIRE_BUFFER_LENGTH
+// accordingly. On AVR, defining FS_DIRECT_TWI bypasses Wire for page writes
+// and sends a whole EEPROM page within one transmission using the TWI
+// registers directly (TWI initialized by Wire.begin()).
+//#define FS_WIRE_BUFFER_LENGTH	128
+//#define FS_DIRECT_TWI
+
+// If the geometry of the EEPROM is known at compile time, defining both
+// FS_STATIC_DEVICE_SIZE and FS_STATIC_PAGE_SIZE binds flashFs to a
+// StaticFlashFS of that geometry: page offsets and alignment become masks,
+// device address and address bytes become constants. FlashFS is compiled
+// for this geometry only: it has no public constructor then, and any other
+// geometry given to StaticFlashFS or openDevice() is refused.
+//#define FS_STATIC_DEVICE_SIZE	EEPROMSize32k
+//#define FS_STATIC_PAGE_SIZE		64
+
+// defining both FS_NOR_DEVICE_SIZE and FS_NOR_CS_PIN binds flashFs to a
+// NorFlashFS (NorFlashFS.h) on a SPI NOR flash of up to 16M instead.
+//#define FS_NOR_DEVICE_SIZE		(uint32_t(1) << 22)
+//#define FS_NOR_CS_PIN				10
+
+// defining FS_TRACE records the logical operations of FlashFS and File into
+// a trace, replayed on the host by tools/fsreplay. Requires class File.
+//#define FS_TRACE
+#if defined(FS_TRACE) && !defined(FS_USE_SEPARATE_FILE)
+	#error "FS_TRACE requires FS_USE_SEPARATE_FILE"
+#endif
+
 #if defined (__arm__) && defined (__SAM3X8E__)
 	#define FS_PACKED	__attribute__((packed))
 #else
 	#define FS_PACKED
 #endif
 
-// FlashFS requires at least 2k x 8 eeproms, since the directory takes already 320 bytes.
+// FlashFS requires at least 2k x 8 eeproms, since the directory takes already 544 bytes.
 
 // one adress byte inline
 // using P0, P1, P2 in device address
@@ -59,10 +117,11 @@ class FlashFS
 private:
 	// not visible outside.
 	static const uint32_t MAGIC_TLFILESYSTEM	= 0x544C4653;
-	static const uint32_t FILESYSTEMVERSION		= 0x0100;	// major 01, minor 00
+	static const uint32_t FILESYSTEMVERSION		= 0x0102;	// major 01, minor 02
 	static const uint32_t MAXFILEENTRIES		= 16;
 	static const uint32_t MAXNAMELEN			= 9;
 	static const uint32_t DEFAULT_EEPROM_ADDR	= 0x050;
+	static const uint16_t MINPAGESIZE			= 16;		// entry head in one page write
 
 public:
 	static const int ERROR_NONE					=  0;
@@ -74,21 +133,91 @@ public:
 	static const int ERROR_POSITION_BEYOND_EOF	= -6;
 	static const int ERROR_DIR_TABLE_FULL		= -7;
 	static const int ERROR_NOT_ENOUGH_SPACE		= -8;
-
+	static const int ERROR_UPDATE_PENDING		= -9;
+	static const int ERROR_NO_UPDATE			= -10;
+	static const int ERROR_GEOMETRY_FIXED		= -11;
+	static const int ERROR_LIST_FORMAT			= -12;
+	static const int ERROR_NO_RESTORE			= -13;
+	static const int ERROR_PATTERN_NOT_FOUND	= -14;
+	static const int ERROR_PIN_BUDGET			= -15;
+	static const int ERROR_RECORD_FORMAT		= -16;
+	static const int ERROR_DEVICE_WRITE			= -17;
+	static const int ERROR_PAGE_SIZE			= -18;
+
+	// trace records: an op code followed by its payload. TRACE_START carries
+	// the geometry and the directory as is (header and files), thus the
+	// replay starts from the traced state.
+	static const uint8_t TRACE_START			= 'S';	// TraceStart, directory
+	static const uint8_t TRACE_FORMAT			= 'F';	// TraceName
+	static const uint8_t TRACE_CREATE			= 'C';	// TraceName
+	static const uint8_t TRACE_OPEN				= 'O';	// TraceName
+	static const uint8_t TRACE_DELETE			= 'D';	// TraceName
+	static const uint8_t TRACE_RESIZE			= 'Z';	// TraceName
+	static const uint8_t TRACE_UPDATE			= 'U';	// TraceName
+	static const uint8_t TRACE_COMMIT			= 'M';	// TraceData
+	static const uint8_t TRACE_ABORT			= 'A';	// TraceData
+	static const uint8_t TRACE_CLEAN			= 'L';	// TraceData, arg: fillWord
+	static const uint8_t TRACE_WRITE			= 'W';	// TraceData, arg: size
+	static const uint8_t TRACE_READ				= 'R';	// TraceData, arg: size
+	static const uint8_t TRACE_BATCH			= 'B';	// -
+	static const uint8_t TRACE_COMMITBATCH		= 'E';	// -
+	static const uint8_t TRACE_PIN				= 'P';	// TraceName
+	static const uint8_t TRACE_UNPIN			= 'N';	// TraceName
+	static const uint8_t TRACE_FLUSH			= 'H';	// TraceData
+
+	// the head (startAddress ... fillWord) of 16 bytes never crosses a page 
+	// boundary and is updated by a single page write.
 	struct FS_PACKED FileEntry 
 	{
 		uint32_t	startAddress;				// 4 bytes
-		char		name[MAXNAMELEN+1];			// 10 bytes
 		uint32_t	size;						// 4 bytes
-	} ;					// 18 bytes
+		uint32_t	written;					// 4 bytes, high-water mark
+		uint32_t	fillWord;					// 4 bytes, read beyond written
+		char		name[MAXNAMELEN+1];			// 10 bytes
+		uint8_t		reserved[6];				// 6 bytes
+	} ;					// 32 bytes
 
-	FlashFS(uint8_t deviceAddress, uint32_t deviceSize, uint8_t pageSize);
+	// trace payloads, sized alike on AVR, SAM and the host
+	struct TraceStart
+	{
+		uint32_t	deviceSize;
+		uint16_t	version;
+		uint16_t	pageSize;
+		uint16_t	dirSize;				// directory bytes following
+		uint16_t	reserved;
+	};				// 12 bytes
+
+	struct TraceName
+	{
+		uint32_t	size;
+		uint32_t	address;				// start address of the File, if any
+		char		name[MAXNAMELEN+1];
+		uint8_t		reserved[2];
+	};				// 20 bytes
+
+	struct TraceData
+	{
+		uint32_t	address;				// start address of the File
+		uint32_t	pos;
+		uint32_t	arg;
+	};				// 12 bytes
+
+#ifndef FS_STATIC_DEVICE_SIZE
+	FlashFS(uint8_t deviceAddress, uint32_t deviceSize, uint16_t pageSize);
+#endif
 
 	void setDebugEnable(bool mode);
 	int	lastError() const;
 
-	bool openDevice(uint8_t deviceAddress, uint32_t deviceSize, uint8_t pageSize);
+	bool openDevice(uint8_t deviceAddress, uint32_t deviceSize, uint16_t pageSize);
 	bool openDevice();
+	// probing the geometry of an unformatted device: capacity by address
+	// wrap-around, page size by write wrap-around (bytes restored), recorded
+	// by format(). A formatted device uses the recorded geometry, if any.
+	// Expects two address bytes, i.e. doesn't apply to 2k devices. Pages
+	// below 16 bytes fail with ERROR_PAGE_SIZE: switching a file by a single
+	// write of its entry's head would take two program cycles.
+	bool openDevice(bool probeGeometry);
 	void format(const char* storageName);
 	void dir() const;
 
@@ -108,21 +237,72 @@ public:
 		return m_dir.numFiles;
 	}
 
-	uint8_t pageSize() const
+	uint16_t pageSize() const
 	{
 		return m_pageSize;
 	}
 
+	// bytes taken by the directory at address 0
+	static uint32_t directorySize()
+	{
+		return sizeof(Directory);
+	}
+
+	// with FS_LITE_DIRECTORY the returned entry lives in the entry cache and
+	// stays valid only up to the next directory access.
 	const FileEntry* fileEntry(int idx) const;
 
 	// files:
 	bool exists(const char* fileName) const;
 	int deleteFile(const char* fileName);
+	// keeps the content up to the new size. Grows in place if possible, else
+	// the file is copied page by page to a new location. Reopen Files after.
+	int resizeFile(const char* fileName, uint32_t newSize);
+
+	// batch: directory writes of createFile(), deleteFile(), resizeFile() 
+	// and high-water mark updates are kept in RAM, the outermost 
+	// commitBatch() writes the directory once. Nestable. Not power fail 
+	// safe, and with FS_LITE_DIRECTORY evicted entries are still written.
+	void beginBatch();
+	void commitBatch();
+
+	// raw restore of a volume image (see tools/mkflashfs), e.g. received 
+	// by Serial: the image is written strictly sequentially in full pages,
+	// starting at address 0. endRestore() mounts the restored volume. An
+	// interrupted restore leaves an unusable volume.
+	int beginRestore(uint32_t imageSize);
+	int restoreData(const void* data, uint32_t size);
+	bool endRestore();
+
+#ifdef FS_PIN_BUDGET
+	// loads the whole file into RAM once (again, if already pinned). Reads
+	// within it are served from RAM, writes update both. deleteFile(),
+	// recreating, format() and mounting unpin; resizeFile() and
+	// commitUpdate() reload the pin, dropping it if it no longer fits.
+	// Returns the file size, ERROR_PIN_BUDGET if FS_PIN_FILES or
+	// FS_PIN_BUDGET would be exceeded.
+	int pin(const char* fileName);
+	int unpin(const char* fileName);
+	uint32_t pinnedBytes() const;
+#endif
+
+#ifdef FS_TRACE
+	// records to out (e.g. Serial) unbuffered, or into the existing file 
+	// fileName from its start, collected into page writes. A file trace 
+	// ends silently when the file is full; stopTrace() records the 
+	// file's high-water mark. The trace file must not be used otherwise 
+	// meanwhile, and its own writes aren't part of the trace.
+	void startTrace(Print& out);
+	int startTrace(const char* fileName);
+	void stopTrace();
+#endif
 	
 #ifndef FS_USE_SEPARATE_FILE
 	int createFile(const char* fileName, uint32_t size);
 	int openFile(const char* fileName);
 	int cleanFile(uint32_t fillWord = 0x0);
+	// records the high-water mark in the directory, see File::flush()
+	int flush();
 	void close();
 
 	// --> moved to class File
@@ -172,6 +352,16 @@ private:
 	int createFile(const char* fileName, uint32_t size);
 	int openFile(const char* fileName);
 #endif
+	const FileEntry* fileEntryAt(uint32_t startAddress) const;
+	// persist false: the entry changes in RAM only, it's written along with
+	// the next directory write or persisting update.
+	int updateSparseState(uint32_t startAddress, uint32_t written, uint32_t fillWord, bool persist = true);
+
+	// shadow copy updates: space for the new content is reserved in RAM only,
+	// the switch is a single write of the file entry's head.
+	const FileEntry* reserveShadow(const char* fileName, uint32_t size);
+	int commitShadow(uint32_t shadowStart, uint32_t written, uint32_t fillWord);
+	void releaseShadow(uint32_t shadowStart);
 
 	struct GapInfo
 	{
@@ -180,42 +370,233 @@ private:
 		uint32_t	gapSize;
 	};
 
-	struct FS_PACKED Directory
+	struct Extent
+	{
+		uint32_t	start;
+		uint32_t	end;					// page aligned
+	};
+
+	struct FS_PACKED DirHeader
 	{
 		uint32_t	magicID;				//   4 bytes
 		uint16_t	version;				//   2 bytes
 		char		name[MAXNAMELEN+1];		//  10 bytes
-		uint16_t	reserved[6];			//   2 bytes x 6
+		uint16_t	pageSize;				//   2 bytes, probed geometry
+		uint16_t	deviceSizeLog2;			//   2 bytes, 0: not probed
+		uint16_t	reserved[4];			//   2 bytes x 4
 		uint32_t	numFiles;				//   4 bytes
-		FileEntry	files[MAXFILEENTRIES];	//  18 bytes x 16
-	};				// 320 bytes
+	};				// 32 bytes
+
+	struct FS_PACKED Directory : DirHeader
+	{
+		FileEntry	files[MAXFILEENTRIES];	//  32 bytes x 16
+	};				// 544 bytes
+
+#ifdef FS_LITE_DIRECTORY
+	struct CacheSlot
+	{
+		int8_t		idx;					// -1: slot unused
+		uint8_t		age;					// 0: most recently used
+		bool		dirty;					// needs write back
+		FileEntry	entry;
+	};
+#endif
 
 	// helper
 	int latchError(int val) const;
 	int findFile(const char* fileName) const;
+	uint8_t collectExtents(Extent* extents) const;
 	GapInfo findBestFittingGap(uint32_t size) const;
-	uint32_t pageAlign(uint32_t address, bool upwards) const;
+	uint32_t probeDeviceSize();
+	bool continuesInto(uint32_t blockStart);
+	uint16_t probePageSize();
+	bool acknowledges(uint8_t devAddress) const;
+	void copyData(uint32_t from, uint32_t to, uint32_t size);
 	void insertFilesEntry(int atIdx);
 	void removeFilesEntry(int atIdx);
+#ifdef FS_TRACE
+	void traceStart();
+	void trace(uint8_t op, const void* payload, uint8_t size);
+	void traceName(uint8_t op, const char* name, uint32_t size, uint32_t address);
+	void traceData(uint8_t op, uint32_t address, uint32_t pos, uint32_t arg);
+	void traceOut(const void* data, uint16_t size);
+#endif
+#ifdef FS_PIN_BUDGET
+	struct Pin
+	{
+		uint32_t	startAddress{0};		// 0: slot unused
+		uint32_t	size{0};
+		unique_ptr<char, _array_destructor> data;
+	};
+
+	int loadPin(uint32_t startAddress, uint32_t size);
+	bool dropPin(uint32_t startAddress);
+	void dropPins();
+	void reloadPin(uint32_t oldStart, const char* fileName);
+	bool readPinned(uint32_t address, char* data, uint32_t size) const;
+	void writePinned(uint32_t address, const char* data, uint32_t size);
+#endif
+
+	// sparse files: bytes beyond FileEntry::written are never read from the
+	// EEPROM, but reproduce the file's fillWord.
+	static void fillPattern(char* data, uint32_t filePos, uint32_t size, uint32_t fillWord);
+	void writePattern(uint32_t address, uint32_t filePos, uint32_t size, uint32_t fillWord);
+	void setSparseState(int idx, uint32_t written, uint32_t fillWord);
+
+	// access to the file entries, either in m_dir or through the entry cache
+	const FileEntry& entry(int idx) const;
+	void storeEntry(int idx, const FileEntry& fileEntry);
+#ifdef FS_LITE_DIRECTORY
+	CacheSlot& cacheSlot(int idx) const;
+	void writeBackSlot(CacheSlot& slot) const;
+	void clearCache();
+#endif
 
 	// doing the IO to the EEPROM
 	void writeDirectory();
-	uint8_t beginAndWriteAddress(uint32_t address);
-	void write(uint32_t address, const char* data, uint32_t size);
-	void read(uint32_t address, char* data, uint32_t size);
+	void writeEntryHead(int idx, const FileEntry& fileEntry);
+	uint8_t beginAndWriteAddress(uint32_t address) const;
+	void write(uint32_t address, const char* data, uint32_t size)
+	{
+		if (!deviceWrite(address, data, size))
+			m_writeFailed = true;	// until the next data write or flush
+#ifdef FS_PIN_BUDGET
+		writePinned(address, data, size);
+#endif
+	}
+	void read(uint32_t address, char* data, uint32_t size) const
+	{
+#ifdef FS_PIN_BUDGET
+		if (readPinned(address, data, size))
+			return;
+#endif
+		deviceRead(address, data, size);
+	}
 
 	bool		m_dbgEnable;
+	bool		m_geometryProbed;
+	bool		m_fixedGeometry;
+	uint8_t		m_batchDepth;
+	bool		m_batchPending;				// directory write deferred
+	bool		m_writeFailed;				// a page was not acknowledged
+	unique_ptr<char, _array_destructor> m_restorePage;
+	uint32_t	m_restoreAddress;
+	uint32_t	m_restoreSize;
+	uint16_t	m_restoreFill;
+#ifdef FS_TRACE
+	Print*		m_traceOut;
+	unique_ptr<char, _array_destructor> m_tracePage;
+	uint32_t	m_traceStart;				// trace file
+	uint32_t	m_traceAddress;				// of the current page
+	uint32_t	m_traceEnd;
+	uint16_t	m_traceFill;
+#endif
+#ifdef FS_PIN_BUDGET
+	Pin			m_pins[FS_PIN_FILES];
+#endif
+
+protected:
+	// geometry, constants of StaticFlashFS with FS_STATIC_DEVICE_SIZE
+	FlashFS(uint8_t deviceAddress, uint32_t deviceSize, uint16_t pageSize, bool fixedGeometry);
+
+	uint32_t pageOffset(uint32_t address) const;
+	uint32_t pageAlign(uint32_t address, bool upwards) const;
+	uint8_t deviceAddress(uint32_t address) const;
+	uint8_t addressBytes() const;
+
+	// device IO, I2C EEPROM by default (NorFlashFS: SPI NOR flash). The
+	// bytes of [from, to) are discarded before writing behind a file's 
+	// high-water mark, so a flash backend may erase them without saving.
+	// deviceWrite() fails if the device doesn't acknowledge a chunk.
+	virtual bool deviceWrite(uint32_t address, const char* data, uint32_t size);
+	virtual void deviceRead(uint32_t address, char* data, uint32_t size) const;
+	virtual void deviceDiscard(uint32_t from, uint32_t to);
+
 	uint8_t		m_deviceAddress;
 	uint32_t	m_deviceSize;
-	uint8_t		m_pageSize;
+	uint16_t	m_pageSize;
 
+private:
+
+#ifndef FS_LITE_DIRECTORY
 	Directory	m_dir;
+#else
+	DirHeader	m_dir;
+	mutable CacheSlot m_cache[FS_DIR_CACHE_ENTRIES];
+#endif
 	int32_t		m_openFile;
+	FileEntry	m_shadow;					// pending update, startAddress 0: none
+	uint32_t	m_shadowOf;					// startAddress of the updated file
 #ifndef FS_USE_SEPARATE_FILE
 	uint32_t	m_filePos;
+	bool		m_markPending;				// high-water mark in RAM only
+#endif
+};
+
+#ifdef FS_STATIC_DEVICE_SIZE
+#ifdef FS_NOR_DEVICE_SIZE
+#error "FS_STATIC_DEVICE_SIZE and FS_NOR_DEVICE_SIZE exclude each other"
+#endif
+
+// flashFs with FS_STATIC_DEVICE_SIZE and FS_STATIC_PAGE_SIZE, the geometry
+// functions of FlashFS use its constants. The only way to get a FlashFS in
+// such a build, a second instance has the same geometry. Since the geometry
+// is fixed, openDevice(true) doesn't probe.
+template<uint32_t DeviceSize, uint16_t PageSize>
+class StaticFlashFS : public FlashFS
+{
+	static_assert((DeviceSize == FS_STATIC_DEVICE_SIZE) && (PageSize == FS_STATIC_PAGE_SIZE)
+				, "FlashFS is compiled for FS_STATIC_DEVICE_SIZE and FS_STATIC_PAGE_SIZE");
+	static_assert((PageSize & (PageSize - 1)) == 0, "page size must be a power of 2");
+	static_assert(PageSize >= 16, "pages of 16 bytes and up");
+	static_assert(   (DeviceSize >= EEPROMSize2k)
+				  && ((DeviceSize & (DeviceSize - 1)) == 0), "unsupported device size");
+
+public:
+	StaticFlashFS(uint8_t deviceAddress = 0x050)
+		: FlashFS(deviceAddress, DeviceSize, PageSize, true)
+	{
+	}
+
+	static const uint8_t ADDRESSBYTES =
+#ifdef FLASHFS_SUPPORT_FOR_HIGHCAPACITY
+		(DeviceSize > EEPROMSize128M) ? 4 :
+		(DeviceSize > EEPROMSize512k) ? 3 :
 #endif
+		(DeviceSize > EEPROMSize2k)   ? 2 : 1;
+
+	// P0, P1, P2 carry the address bits above the inline address bytes,
+	// there are none beside four address bytes.
+	static const uint8_t PBITSSHIFT = (ADDRESSBYTES < 4) ? 8 * ADDRESSBYTES : 0;
+	static const uint8_t PBITSMASK  = ((ADDRESSBYTES < 4) && ((DeviceSize >> PBITSSHIFT) > 1))
+									? uint8_t((DeviceSize >> PBITSSHIFT) - 1) & 0x07
+									: 0;
 };
 
+typedef StaticFlashFS<FS_STATIC_DEVICE_SIZE, FS_STATIC_PAGE_SIZE> StaticGeometry;
+
+inline uint32_t FlashFS::pageOffset(uint32_t address) const
+{
+	return address & (FS_STATIC_PAGE_SIZE - 1);
+}
+
+inline uint32_t FlashFS::pageAlign(uint32_t address, bool upwards) const
+{
+	return (upwards ? address + (FS_STATIC_PAGE_SIZE - 1) : address) & ~uint32_t(FS_STATIC_PAGE_SIZE - 1);
+}
+
+inline uint8_t FlashFS::deviceAddress(uint32_t address) const
+{
+	return (m_deviceAddress & ~StaticGeometry::PBITSMASK) 
+		 | (uint8_t(address >> StaticGeometry::PBITSSHIFT) & StaticGeometry::PBITSMASK);
+}
+
+inline uint8_t FlashFS::addressBytes() const
+{
+	return StaticGeometry::ADDRESSBYTES;
+}
+#endif
+
 class File
 {
 public:
@@ -223,6 +604,8 @@ public:
 	File(const File& other);
 	File(const char* fileName);
 	File(const char* fileName, uint32_t size);
+	// closes the file, aborting a pending update
+	~File();
 	
 	int	lastError() const
 	{
@@ -231,7 +614,23 @@ public:
 	
 	int createFile(const char* fileName, uint32_t size);
 	int openFile(const char* fileName);
+
+	// atomic update: the new content of fileName is written into a shadow
+	// area, readers keep the old content until commitUpdate() switches the
+	// file to the shadow with a single directory write. close() aborts.
+	// Only one update may be pending at a time.
+	int beginUpdate(const char* fileName, uint32_t size);
+	int commitUpdate();
+
+	// sparse: only marks the file as clean, reading returns the fillWord
+	// until the file gets written again. No data is written to the EEPROM.
 	int cleanFile(uint32_t fillWord = 0x0);
+
+	// writes moving the high-water mark change the directory in RAM only,
+	// flush() and close() record the mark with a single write of the entry
+	// head. After a power loss, data behind the recorded mark reads as
+	// fillWord.
+	int flush();
 	void close();
 
 	// data:
@@ -247,6 +646,20 @@ public:
 		return m_fileSize;
 	}
 
+	// start address on the device, 0x0 if not open
+	uint32_t address() const
+	{
+		return m_address;
+	}
+
+	// high-water mark: bytes beyond were never written since creation or
+	// cleanFile() and read as fillWord. Writing behind the mark programs the
+	// gap with the fillWord first, a program cycle per page of the gap.
+	uint32_t written() const
+	{
+		return m_written;
+	}
+
 	// generic: write block of data to sequential file
 	int write(const void* data, uint32_t size);
 
@@ -275,17 +688,118 @@ public:
 		return read(&data, sizeof(T));
 	}
 
+	// position of the next occurrence of pattern at or behind fromPos. The
+	// file is scanned in Wire buffer sized reads by a KMP matcher (2 bytes
+	// per pattern byte), thus matches may span reads. pos() stays unchanged.
+	int32_t find(const void* pattern, uint16_t size, uint32_t fromPos = 0);
+
+	// persistence of om::list<T> (omList.h) with mem-copyable T: a header of
+	// element count and size, then the elements streamed in page sized
+	// batches. Both return the number of elements.
+	template<typename T, typename A>
+	int writeList(const list<T, A> &data)
+	{
+		const ListHeader header = { uint16_t(data.size()), uint16_t(sizeof(T)) };
+		const uint32_t size = sizeof(ListHeader) + uint32_t(header.count) * sizeof(T);
+		if (data.size() > 0xFFFF)
+			return latchError(FlashFS::ERROR_LIST_FORMAT);
+		if (m_filePos + size > m_fileSize)
+			return latchError(FlashFS::ERROR_WRITING_BEYOND_EOF);
+#ifdef FS_TRACE
+		trace(FlashFS::TRACE_WRITE, m_filePos, size);	// replayed as one write
+#endif
+
+		StreamBuffer stream;
+		int result = streamBegin(stream, size);
+		if (result >= 0)
+			result = streamOut(stream, &header, sizeof(ListHeader));
+		for (auto it = data.begin(); (result >= 0) && (it != data.end()); ++it)
+			result = streamOut(stream, &(*it), sizeof(T));
+		if (result >= 0)
+			result = streamFlush(stream);
+		return latchError((result < 0) ? result : int(header.count));
+	}
+
+	// replaces the content of data
+	template<typename T, typename A>
+	int readList(list<T, A> &data)
+	{
+		ListHeader header;
+		int result = read(header);
+		if (result < 0)
+			return result;
+		if (header.elementSize != sizeof(T))
+			return latchError(FlashFS::ERROR_LIST_FORMAT);
+
+		StreamBuffer stream;
+		result = streamBegin(stream, uint32_t(header.count) * sizeof(T));
+		data.clear();
+		T element;
+		for (uint16_t i = 0; (result >= 0) && (i < header.count); ++i)
+		{
+			result = streamIn(stream, &element, sizeof(T));
+			if (result >= 0)
+				data.push_back(element);
+		}
+		return latchError((result < 0) ? result : int(header.count));
+	}
+
+	// compact records (Serialize.h): the fields of record encoded as
+	// described by fields, streamed in page sized batches like lists.
+	// readRecord() fetches at most maxEncodedSize() bytes and leaves pos()
+	// behind the record. Both return the encoded size.
+	int writeRecord(const void* record, const serialize::Field* fields, uint8_t count);
+	int readRecord(void* record, const serialize::Field* fields, uint8_t count);
+
 private:	
+	struct ListHeader
+	{
+		uint16_t	count;
+		uint16_t	elementSize;
+	};
+
+	// buffers a sequence of small reads or writes, thus the EEPROM is
+	// accessed in page sized batches only.
+	struct StreamBuffer
+	{
+		unique_ptr<char, _array_destructor> buffer;
+		uint16_t	capacity;
+		uint16_t	limit;				// out: current batch ends at a page boundary
+		uint16_t	fill;
+		uint16_t	pos;				// in: bytes consumed from buffer
+		uint32_t	left;				// in: bytes still to be fetched
+		uint32_t	written;			// out: high-water mark at streamBegin
+	};
+
 	int latchError(int val);
+	void assign(const FlashFS::FileEntry* entry);
+	void syncSparseState();
+	void markWritten();
+#ifdef FS_TRACE
+	void trace(uint8_t op, uint32_t pos, uint32_t arg);
+#endif
+	int writeData(const void* data, uint32_t size);
+	int streamBegin(StreamBuffer &stream, uint32_t size);
+	int streamOut(StreamBuffer &stream, const void* data, uint16_t size);
+	int streamFlush(StreamBuffer &stream);
+	int streamIn(StreamBuffer &stream, void* data, uint16_t size);
 
 	int			m_lastError{FlashFS::ERROR_NONE};
 	uint32_t	m_address{0x0};
 	uint32_t	m_filePos{0x0};
 	uint32_t	m_fileSize{0x0};
+	uint32_t	m_written{0x0};
+	uint32_t	m_fillWord{0x0};
+	bool		m_update{false};
+	bool		m_markPending{false};		// high-water mark not yet recorded
 };
 
 }
 
+#if defined(FS_STATIC_DEVICE_SIZE) || defined(FS_NOR_DEVICE_SIZE)
+extern om::FlashFS& flashFs;
+#else
 extern om::FlashFS flashFs;
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include <Arduino.h>
+
+#include "IsrLog.h"
+
+namespace om {
+
+IsrLog::IsrLog(const char* fileName, uint8_t recordSize, uint8_t capacity)
+	: m_recordSize(recordSize)
+	, m_capacity(1)
+{
+	strncpy(m_name, fileName, 9);
+	m_name[9] = '\0';
+
+	// rounded down to a power of 2
+	while ((m_capacity < 128) && (2 * m_capacity <= capacity))
+		m_capacity <<= 1;
+	m_ring = new char[uint16_t(m_capacity) * m_recordSize];
+}
+
+int IsrLog::begin(uint32_t fileSize)
+{
+	if (   (m_file.openFile(m_name) < 0)
+		&& (m_file.createFile(m_name, fileSize) < 0))
+		return latchError(m_file.lastError());
+
+	// the page buffer starts at the page of the high-water mark, the bytes
+	// in front of it are written already.
+	const uint16_t pageSize = flashFs.pageSize();
+	m_page = new char[pageSize];
+	m_fill = m_file.written() % pageSize;
+	m_flushed = m_fill;
+	m_pageStart = m_file.written() - m_fill;
+	m_dropped = 0;
+	return latchError(int(m_file.written()));
+}
+
+int IsrLog::drain()
+{
+	if (!m_page)
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
+
+	const uint16_t pageSize = flashFs.pageSize();
+	int drained = 0;
+	for (uint8_t tail = m_tail; tail != m_head; ++tail)
+	{
+		// a full file keeps the records staged, further ones are dropped
+		if (pos() + m_recordSize > m_file.size())
+			return latchError(FlashFS::ERROR_WRITING_BEYOND_EOF);
+
+		barrier();							// the index before its record
+		const char* record = m_ring.get() + uint16_t(tail & (m_capacity - 1)) * m_recordSize;
+		const uint32_t pageStart = m_pageStart;
+		const uint16_t fill = m_fill;
+		for (uint8_t done = 0; done < m_recordSize; )
+		{
+			uint16_t chunkSize = pageSize - m_fill;
+			if (chunkSize > m_recordSize - done)
+				chunkSize = m_recordSize - done;
+			memcpy(m_page.get() + m_fill, record + done, chunkSize);
+			m_fill += chunkSize;
+			done += chunkSize;
+
+			if ((m_fill == pageSize) || (pos() == m_file.size()))
+			{
+				const int result = writePage(m_fill);
+				if (result < 0)
+				{
+					// the record stays staged, the next drain() starts it over
+					if (m_pageStart != pageStart)
+						m_flushed = fill;		// its first page is written
+					m_pageStart = pageStart;
+					m_fill = fill;
+					return result;
+				}
+				if (m_fill == pageSize)
+				{
+					m_pageStart += pageSize;
+					m_fill = m_flushed = 0;
+				}
+			}
+		}
+		barrier();							// the record before releasing it
+		m_tail = tail + 1;
+		++drained;
+	}
+	return latchError(drained);
+}
+
+int IsrLog::flush()
+{
+	if (!m_page)
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
+	const int result = writePage(m_fill);
+	if (result < 0)
+		return result;
+	const int marked = m_file.flush();
+	return latchError((marked < 0) ? marked : result);
+}
+
+uint32_t IsrLog::dropped() const
+{
+	// may be incremented meanwhile, thus read until stable (4 bytes on AVR)
+	uint32_t count;
+	do
+	{
+		count = m_dropped;
+	} while (count != m_dropped);
+	return count;
+}
+
+int IsrLog::latchError(int val)
+{
+	m_lastError = (val < 0) ? val : FlashFS::ERROR_NONE;
+	return val;
+}
+
+int IsrLog::writePage(uint16_t end)
+{
+	if (end == m_flushed)
+		return latchError(0);
+
+	m_file.setPos(m_pageStart + m_flushed);
+	const int result = m_file.write(m_page.get() + m_flushed, end - m_flushed);
+	if (result < 0)
+		return latchError(result);
+	m_flushed = end;
+	return latchError(result);
+}
+
+}
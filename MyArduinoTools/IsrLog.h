@@ -0,0 +1,112 @@
+#ifndef OM_ISRLOG_H
+#define OM_ISRLOG_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "FlashFS.h"
+#include "omMemory.h"
+
+namespace om {
+
+// Appending records of fixed size to a FlashFS file from interrupt context,
+// e.g. samples of a timer ISR. append() only copies the record into a ring
+// buffer of capacity records (single producer, single consumer, no locks),
+// drain() in loop() moves them into a page buffer and writes full pages to
+// the file behind its high-water mark. Records not fitting into the ring
+// are dropped and counted.
+//	IsrLog log("SAMPLES", sizeof(Sample), 32);
+//	ISR:	log.append(&sample);
+//	loop:	log.drain();
+class IsrLog
+{
+public:
+	// fileName up to 9 chars. capacity: power of 2, up to 128 records, thus
+	// the ring indices are single bytes and read atomically on AVR, too.
+	IsrLog(const char* fileName, uint8_t recordSize, uint8_t capacity);
+
+	int	lastError() const
+	{
+		return m_lastError;
+	}
+
+	// opens the log, creating its file of fileSize if missing. Appending
+	// continues behind the file's high-water mark.
+	int begin(uint32_t fileSize);
+
+	// ISR side: bounded time, no allocation, no bus access. Returns false,
+	// if the ring is full and the record is dropped.
+	bool append(const void* record)
+	{
+		const uint8_t head = m_head;
+		if (uint8_t(head - m_tail) >= m_capacity)
+		{
+			++m_dropped;
+			return false;
+		}
+		memcpy(m_ring.get() + uint16_t(head & (m_capacity - 1)) * m_recordSize, record, m_recordSize);
+		barrier();							// the record before its index
+		m_head = head + 1;
+		return true;
+	}
+
+	template<typename T>
+	bool append(const T &record)
+	{
+		return append(static_cast<const void*>(&record));
+	}
+
+	// loop side: moves the staged records into the page buffer, writing each
+	// page once it is full. Returns the number of drained records.
+	int drain();
+
+	// writes the part of the current page not written yet and records the
+	// file's high-water mark, e.g. before power down. Further records
+	// continue the page.
+	int flush();
+
+	// staged, not yet drained records
+	uint8_t pending() const
+	{
+		return uint8_t(m_head - m_tail);
+	}
+
+	// records dropped since begin()
+	uint32_t dropped() const;
+
+	// file position of the next drained record
+	uint32_t pos() const
+	{
+		return m_pageStart + m_fill;
+	}
+
+private:
+	static void barrier()
+	{
+		// single core: keeping the compiler from reordering suffices
+		__asm__ __volatile__("" ::: "memory");
+	}
+
+	int latchError(int val);
+	int writePage(uint16_t end);
+
+	char		m_name[10];
+	uint8_t		m_recordSize;
+	uint8_t		m_capacity;
+	unique_ptr<char, _array_destructor> m_ring;
+	volatile uint8_t m_head{0};				// written by append() only
+	volatile uint8_t m_tail{0};				// written by drain() only
+	volatile uint32_t m_dropped{0};
+
+	unique_ptr<char, _array_destructor> m_page;
+	uint32_t	m_pageStart{0};				// file position of m_page
+	uint16_t	m_fill{0};
+	uint16_t	m_flushed{0};				// m_page up to here is written
+
+	File		m_file;
+	int			m_lastError{FlashFS::ERROR_NONE};
+};
+
+}
+
+#endif
@@ -0,0 +1,387 @@
+#include <Arduino.h>
+
+#include "KVStore.h"
+
+namespace om {
+
+KVStore::KVStore(const char* fileName, uint16_t maxKeys)
+	: m_maxKeys(maxKeys)
+{
+	m_name[0] = '\0';
+	if (strlen(fileName) <= MAXNAMELEN)
+		strcpy(m_name, fileName);
+
+	// keeping the load factor of the index below 80%
+	uint16_t tableSize = 4;
+	while (tableSize < maxKeys + maxKeys / 4 + 1)
+		tableSize <<= 1;
+	m_mask = tableSize - 1;
+	m_index = new Slot[tableSize];
+	memset(m_index.get(), 0, tableSize * sizeof(Slot));
+}
+
+int KVStore::begin(uint16_t fileSize)
+{
+	const uint8_t nameLen = strlen(m_name);
+	if (nameLen == 0)
+		return latchError(ERROR_INVALID_NAME);
+
+	uint16_t generation[2] = {0, 0};
+	bool valid[2];
+	for (uint8_t i = 0; i < 2; ++i)
+	{
+		m_name[nameLen] = '0' + i;
+		m_name[nameLen+1] = '\0';
+		if (m_files[i].openFile(m_name) < 0)
+		{
+			if (m_files[i].createFile(m_name, fileSize) < 0)
+			{
+				m_name[nameLen] = '\0';
+				return latchError(m_files[i].lastError());
+			}
+			m_files[i].cleanFile(0xFFFFFFFF);	// reads as erased
+		}
+		valid[i] = readHeader(m_files[i], generation[i]);
+	}
+	m_name[nameLen] = '\0';
+	if (m_files[0].address() == m_files[1].address())
+		return latchError(ERROR_INVALID_NAME);	// both names found one file
+
+	if (!valid[0] && !valid[1])
+	{
+		// fresh store: erase file 0 physically once, thus appending a record
+		// never needs to move the file's high-water mark.
+		File &file = m_files[0];
+		file.setPos(file.size() - 1);
+		file.write(uint8_t(0xFF));
+		const uint16_t header[2] = { MAGIC_KVSTORE, 1 };
+		file.setPos(0);
+		file.write(header);
+		file.flush();
+		valid[0] = true;
+		generation[0] = 1;
+	}
+
+	m_active = (!valid[0] || (valid[1] && (int16_t(generation[1] - generation[0]) > 0))) ? 1 : 0;
+	m_generation = generation[m_active];
+	scan();
+	return latchError(m_count);
+}
+
+int KVStore::put(const char* key, const void* value, uint8_t size)
+{
+	const uint8_t keyLen = strlen(key);
+	if ((keyLen == 0) || (keyLen > MAXKEYLEN))
+		return latchError(ERROR_INVALID_KEY);
+	if (size > MAXVALUELEN)
+		return latchError(ERROR_VALUE_SIZE);
+	return latchError(append(key, keyLen, value, size));
+}
+
+int KVStore::get(const char* key, void* value, uint8_t size)
+{
+	const uint8_t keyLen = strlen(key);
+	if ((keyLen > MAXKEYLEN) || (size > MAXVALUELEN))
+		return latchError(ERROR_KEY_NOT_FOUND);
+
+	// reading the complete record of the expected size with one transaction
+	char record[2 + MAXKEYLEN + MAXVALUELEN + 1];
+	const uint16_t length = 2 + keyLen + size + 1;
+	const uint16_t hash = hashKey(key, keyLen);
+	File &file = m_files[m_active];
+	for (uint16_t i = hash & m_mask; m_index[i].offset != 0; i = (i + 1) & m_mask)
+	{
+		if (m_index[i].hash != hash)
+			continue;
+
+		file.setPos(m_index[i].offset);
+		if (   (file.read(record, length) < 0)
+			|| (uint8_t(record[0]) != keyLen)
+			|| (memcmp(record + 2, key, keyLen) != 0))
+			continue;	// hash collision
+
+		if (uint8_t(record[1]) != size)
+			return latchError(ERROR_VALUE_SIZE);
+		memcpy(value, record + 2 + keyLen, size);
+		return latchError(size);
+	}
+	return latchError(ERROR_KEY_NOT_FOUND);
+}
+
+bool KVStore::contains(const char* key)
+{
+	const uint8_t keyLen = strlen(key);
+	return (keyLen <= MAXKEYLEN) && (findSlot(key, keyLen, hashKey(key, keyLen)) >= 0);
+}
+
+int KVStore::remove(const char* key)
+{
+	const uint8_t keyLen = strlen(key);
+	if ((keyLen > MAXKEYLEN) || (findSlot(key, keyLen, hashKey(key, keyLen)) < 0))
+		return latchError(ERROR_KEY_NOT_FOUND);
+	return latchError(append(key, keyLen, nullptr, TOMBSTONE));
+}
+
+int KVStore::compact()
+{
+	File &source = m_files[m_active];
+	File &target = m_files[1 - m_active];
+	target.cleanFile(0xFFFFFFFF);
+
+	// live records are collected into page sized chunks, thus each page of
+	// the target is written once. Any error leaves the source active, the
+	// index is moved to the target after the commit only.
+	const uint16_t pageSize = flashFs.pageSize();
+	unique_ptr<char, _array_destructor> page = new char[pageSize];
+	uint16_t chunkStart = HEADERSIZE;
+	uint16_t chunkFill = 0;
+	uint16_t out = HEADERSIZE;
+	int result;
+	char record[2 + MAXKEYLEN + MAXVALUELEN + 1];
+	for (uint16_t i = 0; i <= m_mask; ++i)
+	{
+		if (m_index[i].offset == 0)
+			continue;
+
+		source.setPos(m_index[i].offset);
+		if ((result = source.read(record, 2)) < 0)
+			return latchError(result);
+		const uint16_t length = 2 + uint8_t(record[0]) + uint8_t(record[1]) + 1;
+		if ((result = source.read(record + 2, length - 2)) < 0)
+			return latchError(result);
+		if (out + length > target.size())
+			return latchError(FlashFS::ERROR_NOT_ENOUGH_SPACE);
+
+		out += length;
+		for (uint16_t done = 0; done < length; )
+		{
+			uint16_t chunkSize = pageSize - (chunkStart + chunkFill) % pageSize;
+			if (chunkSize > length - done)
+				chunkSize = length - done;
+			memcpy(page.get() + chunkFill, record + done, chunkSize);
+			chunkFill += chunkSize;
+			done += chunkSize;
+			if ((chunkStart + chunkFill) % pageSize == 0)
+			{
+				target.setPos(chunkStart);
+				if ((result = target.write(page.get(), chunkFill)) < 0)
+					return latchError(result);
+				chunkStart += chunkFill;
+				chunkFill = 0;
+			}
+		}
+	}
+	if (chunkFill > 0)
+	{
+		target.setPos(chunkStart);
+		if ((result = target.write(page.get(), chunkFill)) < 0)
+			return latchError(result);
+	}
+
+	// erase the remaining space physically, then commit by the header. The
+	// gap fill takes a program cycle per free page at each compaction, but
+	// spares a put the directory write recording its high-water mark.
+	if (target.written() < target.size())
+	{
+		target.setPos(target.size() - 1);
+		if ((result = target.write(uint8_t(0xFF))) < 0)
+			return latchError(result);
+	}
+	const uint16_t header[2] = { MAGIC_KVSTORE, uint16_t(m_generation + 1) };
+	target.setPos(0);
+	if (   ((result = target.write(header)) < 0)
+		|| ((result = target.flush()) < 0))	// before the source is dropped
+		return latchError(result);
+	source.cleanFile(0xFFFFFFFF);
+
+	m_active = 1 - m_active;
+	++m_generation;
+	m_end = out;
+
+	// the records follow each other in index order
+	out = HEADERSIZE;
+	for (uint16_t i = 0; i <= m_mask; ++i)
+	{
+		if (m_index[i].offset == 0)
+			continue;
+
+		target.setPos(out);
+		if (target.read(record, 2) < 0)
+		{
+			scan();
+			break;
+		}
+		m_index[i].offset = out;
+		out += 2 + uint8_t(record[0]) + uint8_t(record[1]) + 1;
+	}
+	return latchError(m_end);
+}
+
+uint16_t KVStore::hashKey(const char* key, uint8_t keyLen)
+{
+	// FNV-1a, folded to 16 bits
+	uint32_t hash = 2166136261UL;
+	for (uint8_t i = 0; i < keyLen; ++i)
+	{
+		hash ^= uint8_t(key[i]);
+		hash *= 16777619UL;
+	}
+	return uint16_t(hash >> 16) ^ uint16_t(hash);
+}
+
+uint8_t KVStore::crc8(const char* data, uint16_t size)
+{
+	uint8_t crc = 0;
+	for (uint16_t i = 0; i < size; ++i)
+	{
+		crc ^= uint8_t(data[i]);
+		for (uint8_t bit = 0; bit < 8; ++bit)
+			crc = (crc & 0x80) ? uint8_t(crc << 1) ^ 0x31 : uint8_t(crc << 1);
+	}
+	return crc;
+}
+
+int KVStore::latchError(int val)
+{
+	m_lastError = (val < 0) ? val : FlashFS::ERROR_NONE;
+	return val;
+}
+
+int KVStore::append(const char* key, uint8_t keyLen, const void* value, uint8_t size)
+{
+	const uint16_t hash = hashKey(key, keyLen);
+	int slot = findSlot(key, keyLen, hash);
+	if ((slot < 0) && (size != TOMBSTONE) && (m_count >= m_maxKeys))
+		return ERROR_INDEX_FULL;
+
+	const uint8_t valueLen = (size == TOMBSTONE) ? 0 : size;
+	const uint16_t length = 2 + keyLen + valueLen + 1;
+	if (m_end + length > m_files[m_active].size())
+	{
+		const int result = compact();
+		if (result < 0)
+			return result;
+		if (m_end + length > m_files[m_active].size())
+			return FlashFS::ERROR_NOT_ENOUGH_SPACE;
+	}
+
+	char record[2 + MAXKEYLEN + MAXVALUELEN + 1];
+	record[0] = keyLen;
+	record[1] = size;
+	memcpy(record + 2, key, keyLen);
+	memcpy(record + 2 + keyLen, value, valueLen);
+	record[length - 1] = crc8(record, length - 1);
+
+	File &file = m_files[m_active];
+	file.setPos(m_end);
+	const int result = file.write(record, length);
+	if (result < 0)
+		return result;
+
+	if (size == TOMBSTONE)
+		eraseSlot(slot);
+	else if (slot >= 0)
+		m_index[slot].offset = m_end;
+	else
+		insertSlot(hash, m_end);
+	m_end += length;
+	return valueLen;
+}
+
+int KVStore::findSlot(const char* key, uint8_t keyLen, uint16_t hash)
+{
+	char record[2 + MAXKEYLEN];
+	File &file = m_files[m_active];
+	for (uint16_t i = hash & m_mask; m_index[i].offset != 0; i = (i + 1) & m_mask)
+	{
+		if (m_index[i].hash != hash)
+			continue;
+
+		file.setPos(m_index[i].offset);
+		file.read(record, 2 + keyLen);
+		if (   (uint8_t(record[0]) == keyLen)
+			&& (memcmp(record + 2, key, keyLen) == 0))
+			return i;
+	}
+	return ERROR_KEY_NOT_FOUND;
+}
+
+bool KVStore::insertSlot(uint16_t hash, uint16_t offset)
+{
+	if (m_count >= m_maxKeys)
+		return false;
+
+	uint16_t i = hash & m_mask;
+	while (m_index[i].offset != 0)
+		i = (i + 1) & m_mask;
+	m_index[i].hash = hash;
+	m_index[i].offset = offset;
+	++m_count;
+	return true;
+}
+
+void KVStore::eraseSlot(int idx)
+{
+	// linear probing: move following entries back into the hole, as long as
+	// it lies between their home slot and their current slot.
+	uint16_t hole = idx;
+	for (uint16_t i = (hole + 1) & m_mask; m_index[i].offset != 0; i = (i + 1) & m_mask)
+	{
+		const uint16_t home = m_index[i].hash & m_mask;
+		if (((i - home) & m_mask) >= ((i - hole) & m_mask))
+		{
+			m_index[hole] = m_index[i];
+			hole = i;
+		}
+	}
+	m_index[hole].offset = 0;
+	--m_count;
+}
+
+bool KVStore::readHeader(File &file, uint16_t &generation)
+{
+	uint16_t header[2];
+	file.setPos(0);
+	if (file.read(header) < 0)
+		return false;
+	generation = header[1];
+	return header[0] == MAGIC_KVSTORE;
+}
+
+void KVStore::scan()
+{
+	memset(m_index.get(), 0, (m_mask + 1) * sizeof(Slot));
+	m_count = 0;
+
+	// the log ends at the first erased or torn record
+	char record[2 + MAXKEYLEN + MAXVALUELEN + 1];
+	File &file = m_files[m_active];
+	for (m_end = HEADERSIZE; uint32_t(m_end) + 3 <= file.size(); )
+	{
+		file.setPos(m_end);
+		file.read(record, 2);
+		const uint8_t keyLen = record[0];
+		const uint8_t valueLen = (uint8_t(record[1]) == TOMBSTONE) ? 0 : uint8_t(record[1]);
+		const uint16_t length = 2 + keyLen + valueLen + 1;
+		if (   (keyLen == 0) || (keyLen > MAXKEYLEN) || (valueLen > MAXVALUELEN)
+			|| (m_end + length > file.size())
+			|| (file.read(record + 2, length - 2) < 0)
+			|| (crc8(record, length - 1) != uint8_t(record[length - 1])))
+			break;
+
+		const uint16_t hash = hashKey(record + 2, keyLen);
+		const int slot = findSlot(record + 2, keyLen, hash);
+		if (uint8_t(record[1]) == TOMBSTONE)
+		{
+			if (slot >= 0)
+				eraseSlot(slot);
+		}
+		else if (slot >= 0)
+			m_index[slot].offset = m_end;
+		else
+			insertSlot(hash, m_end);
+		m_end += length;
+	}
+}
+
+}
@@ -0,0 +1,112 @@
+#ifndef OM_KVSTORE_H
+#define OM_KVSTORE_H
+
+#include <stdint.h>
+
+#include "FlashFS.h"
+#include "omMemory.h"
+
+namespace om {
+
+// Log-structured key-value store, living in the two FlashFS files <name>0 and
+// <name>1. A put appends one record to the active file, a compact in-RAM hash
+// index maps every key to its latest record. If the active file runs full,
+// the live records are compacted into the other file, which becomes active.
+//
+// record:	[keyLen][valueLen][key ...][value ...][crc8]
+class KVStore
+{
+public:
+	static const uint8_t MAXKEYLEN				= 15;
+	static const uint8_t MAXVALUELEN			= 64;
+
+	static const int ERROR_KEY_NOT_FOUND		= -20;
+	static const int ERROR_INVALID_KEY			= -21;
+	static const int ERROR_VALUE_SIZE			= -22;
+	static const int ERROR_INDEX_FULL			= -23;
+	static const int ERROR_INVALID_NAME			= -24;
+
+	// fileName up to 8 chars, a digit is appended for both files. begin()
+	// rejects longer names.
+	KVStore(const char* fileName, uint16_t maxKeys);
+
+	int	lastError() const
+	{
+		return m_lastError;
+	}
+
+	// opens the store, creating both files of fileSize if missing.
+	int begin(uint16_t fileSize);
+
+	uint16_t count() const
+	{
+		return m_count;
+	}
+
+	// bytes used by the log in the active file
+	uint16_t used() const
+	{
+		return m_end;
+	}
+
+	int put(const char* key, const void* value, uint8_t size);
+
+	template<typename T>
+	int put(const char* key, const T &value)
+	{
+		return put(key, &value, sizeof(T));
+	}
+
+	int get(const char* key, void* value, uint8_t size);
+
+	template<typename T>
+	int get(const char* key, T &value)
+	{
+		return get(key, &value, sizeof(T));
+	}
+
+	bool contains(const char* key);
+	int remove(const char* key);
+
+	// drops overwritten and removed records, done by put() if needed.
+	int compact();
+
+private:
+	static const uint8_t MAXNAMELEN				= 8;		// plus the digit
+	static const uint8_t TOMBSTONE				= 0xFF;
+	static const uint8_t HEADERSIZE				= 4;
+	static const uint16_t MAGIC_KVSTORE			= 0x564B;	// "KV"
+
+	struct Slot
+	{
+		uint16_t	hash;
+		uint16_t	offset;		// 0: empty slot
+	};
+
+	static uint16_t hashKey(const char* key, uint8_t keyLen);
+	static uint8_t crc8(const char* data, uint16_t size);
+
+	int latchError(int val);
+	int append(const char* key, uint8_t keyLen, const void* value, uint8_t size);
+	int findSlot(const char* key, uint8_t keyLen, uint16_t hash);
+	bool insertSlot(uint16_t hash, uint16_t offset);
+	void eraseSlot(int idx);
+	bool readHeader(File &file, uint16_t &generation);
+	void scan();
+
+	char		m_name[10];
+	uint16_t	m_maxKeys;
+	uint16_t	m_mask;
+	unique_ptr<Slot, _array_destructor> m_index;
+
+	File		m_files[2];
+	uint8_t		m_active{0};
+	uint16_t	m_generation{0};
+	uint16_t	m_end{0};
+	uint16_t	m_count{0};
+	int			m_lastError{FlashFS::ERROR_NONE};
+};
+
+}
+
+#endif
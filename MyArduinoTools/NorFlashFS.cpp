@@ -0,0 +1,181 @@
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "NorFlashFS.h"
+
+namespace om {
+
+NorFlashFS::NorFlashFS(uint8_t csPin, uint32_t deviceSize, uint32_t clock)
+	: FlashFS(0x0, deviceSize, SECTORSIZE, true)
+	, m_csPin(csPin)
+	, m_clock(clock)
+	, m_ready(false)
+	, m_staleFrom(0)
+	, m_staleTo(0)
+{
+}
+
+bool NorFlashFS::deviceWrite(uint32_t address, const char* data, uint32_t size)
+{
+	while (size > 0)
+	{
+		const uint32_t sector = address & ~uint32_t(SECTORSIZE - 1);
+		uint32_t chunkSize = sector + SECTORSIZE - address;
+		if (chunkSize > size)
+			chunkSize = size;
+
+		if (programmable(address, data, chunkSize))
+			program(address, data, chunkSize);
+		else
+			rewriteSector(sector, address, data, chunkSize);
+
+		// written bytes are valid data again
+		if ((address + chunkSize > m_staleFrom) && (address < m_staleTo))
+			m_staleFrom = address + chunkSize;
+
+		address += chunkSize;
+		data	+= chunkSize;
+		size	-= chunkSize;
+	}
+	return true;	// SPI has no acknowledge
+}
+
+void NorFlashFS::deviceRead(uint32_t address, char* data, uint32_t size) const
+{
+	// no chunks: reading streams on up to the end of the device
+	if (size == 0)
+		return;
+	select();
+	command(CMD_READ, address);
+	for (uint32_t i = 0; i < size; ++i)
+		data[i] = SPI.transfer(0xFF);
+	deselect();
+}
+
+void NorFlashFS::deviceDiscard(uint32_t from, uint32_t to)
+{
+	m_staleFrom = from;
+	m_staleTo = to;
+}
+
+void NorFlashFS::select() const
+{
+	if (!m_ready)
+	{
+		pinMode(m_csPin, OUTPUT);
+		digitalWrite(m_csPin, HIGH);
+		SPI.begin();
+		m_ready = true;
+	}
+	SPI.beginTransaction(SPISettings(m_clock, MSBFIRST, SPI_MODE0));
+	digitalWrite(m_csPin, LOW);
+}
+
+void NorFlashFS::deselect() const
+{
+	digitalWrite(m_csPin, HIGH);
+	SPI.endTransaction();
+}
+
+void NorFlashFS::command(uint8_t cmd, uint32_t address) const
+{
+	SPI.transfer(cmd);
+	SPI.transfer(uint8_t(address >> 16));
+	SPI.transfer(uint8_t(address >> 8));
+	SPI.transfer(uint8_t(address));
+}
+
+void NorFlashFS::waitReady() const
+{
+	select();
+	SPI.transfer(CMD_READSTATUS);
+	while (SPI.transfer(0xFF) & STATUS_BUSY)
+		;
+	deselect();
+}
+
+bool NorFlashFS::programmable(uint32_t address, const char* data, uint32_t size) const
+{
+	// programming may clear bits only
+	char current[32];
+	while (size > 0)
+	{
+		uint32_t chunkSize = size;
+		if (chunkSize > sizeof(current))
+			chunkSize = sizeof(current);
+		deviceRead(address, current, chunkSize);
+		for (uint32_t i = 0; i < chunkSize; ++i)
+			if ((current[i] & data[i]) != data[i])
+				return false;
+
+		address += chunkSize;
+		data	+= chunkSize;
+		size	-= chunkSize;
+	}
+	return true;
+}
+
+void NorFlashFS::program(uint32_t address, const char* data, uint32_t size)
+{
+	// page program wraps around within its page, erased bytes are skipped
+	while (size > 0)
+	{
+		uint32_t chunkSize = PROGRAMPAGESIZE - (address & (PROGRAMPAGESIZE - 1));
+		if (chunkSize > size)
+			chunkSize = size;
+
+		bool erased = true;
+		for (uint32_t i = 0; erased && (i < chunkSize); ++i)
+			erased = (uint8_t(data[i]) == 0xFF);
+		if (!erased)
+		{
+			select();
+			SPI.transfer(CMD_WRITEENABLE);
+			deselect();
+			select();
+			command(CMD_PAGEPROGRAM, address);
+			for (uint32_t i = 0; i < chunkSize; ++i)
+				SPI.transfer(uint8_t(data[i]));
+			deselect();
+			waitReady();
+		}
+
+		address += chunkSize;
+		data	+= chunkSize;
+		size	-= chunkSize;
+	}
+}
+
+void NorFlashFS::rewriteSector(uint32_t sector, uint32_t address, const char* data, uint32_t size)
+{
+	// read, erase, reprogram: discarded bytes don't need to survive
+	if (!m_sector)
+		m_sector = new char[SECTORSIZE];
+	char* buffer = m_sector.get();
+	deviceRead(sector, buffer, SECTORSIZE);
+	const uint32_t staleFrom = (m_staleFrom > sector) ? m_staleFrom : sector;
+	const uint32_t staleTo = (m_staleTo < sector + SECTORSIZE) ? m_staleTo : sector + SECTORSIZE;
+	if (staleFrom < staleTo)
+		memset(buffer + (staleFrom - sector), 0xFF, staleTo - staleFrom);
+	if (sector == 0)	// the first file starts at the next sector
+		memset(buffer + directorySize(), 0xFF, SECTORSIZE - directorySize());
+	memcpy(buffer + (address - sector), data, size);
+
+	select();
+	SPI.transfer(CMD_WRITEENABLE);
+	deselect();
+	select();
+	command(CMD_SECTORERASE, sector);
+	deselect();
+	waitReady();
+	program(sector, buffer, SECTORSIZE);
+}
+
+}
+
+// provide singleton
+#ifdef FS_NOR_DEVICE_SIZE
+static_assert(FS_NOR_DEVICE_SIZE <= (uint32_t(1) << 24), "3 address bytes address up to 16M");
+static om::NorFlashFS _norFlashFs(FS_NOR_CS_PIN, FS_NOR_DEVICE_SIZE);
+om::FlashFS& flashFs = _norFlashFs;
+#endif
@@ -0,0 +1,58 @@
+#ifndef OM_NORFLASHFS_H
+#define OM_NORFLASHFS_H
+
+#include <stdint.h>
+
+#include "FlashFS.h"
+#include "omMemory.h"
+
+namespace om {
+
+// FlashFS on a SPI NOR flash (e.g. W25Q32, up to 16M, 3 address bytes).
+// NOR flash is erased in sectors of 4k to 0xFF, programming clears bits
+// only, in pages of 256 bytes. Thus the FlashFS page is the erase sector:
+// files start at sectors of their own, and writing behind a file's
+// high-water mark erases the discarded sectors without saving them. Only
+// overwriting written data (and the directory in sector 0) reads, erases
+// and reprograms the sector.
+//	NorFlashFS flash(10, uint32_t(1) << 22);	// CS pin 10, 4M
+class NorFlashFS : public FlashFS
+{
+public:
+	static const uint16_t SECTORSIZE			= 4096;
+	static const uint16_t PROGRAMPAGESIZE		= 256;
+
+	NorFlashFS(uint8_t csPin, uint32_t deviceSize, uint32_t clock = 8000000);
+
+protected:
+	bool deviceWrite(uint32_t address, const char* data, uint32_t size) override;
+	void deviceRead(uint32_t address, char* data, uint32_t size) const override;
+	void deviceDiscard(uint32_t from, uint32_t to) override;
+
+private:
+	static const uint8_t CMD_READ				= 0x03;
+	static const uint8_t CMD_WRITEENABLE		= 0x06;
+	static const uint8_t CMD_PAGEPROGRAM		= 0x02;
+	static const uint8_t CMD_SECTORERASE		= 0x20;
+	static const uint8_t CMD_READSTATUS			= 0x05;
+	static const uint8_t STATUS_BUSY			= 0x01;
+
+	void select() const;
+	void deselect() const;
+	void command(uint8_t cmd, uint32_t address) const;
+	void waitReady() const;
+	bool programmable(uint32_t address, const char* data, uint32_t size) const;
+	void program(uint32_t address, const char* data, uint32_t size);
+	void rewriteSector(uint32_t sector, uint32_t address, const char* data, uint32_t size);
+
+	uint8_t		m_csPin;
+	uint32_t	m_clock;
+	mutable bool m_ready;					// SPI and CS pin set up
+	uint32_t	m_staleFrom;				// discarded, may be erased
+	uint32_t	m_staleTo;
+	unique_ptr<char, _array_destructor> m_sector;	// by the first rewrite
+};
+
+}
+
+#endif
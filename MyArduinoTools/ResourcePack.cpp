@@ -0,0 +1,99 @@
+#include <Arduino.h>
+
+#include "ResourcePack.h"
+
+namespace om {
+
+ResourcePack::ResourcePack(const char* fileName)
+{
+	strncpy(m_name, fileName, 9);
+	m_name[9] = '\0';
+}
+
+int ResourcePack::begin()
+{
+	m_header = Header();
+	m_assetSize = m_assetPos = 0;
+	if (m_file.openFile(m_name) < 0)
+		return latchError(m_file.lastError());
+
+	if (   (m_file.read(m_header) < 0)
+		|| (m_header.magic != MAGIC_PACK)
+		|| ((m_header.count > 0) && (m_header.buckets == 0)))
+	{
+		m_header = Header();
+		return latchError(ERROR_PACK_FORMAT);
+	}
+
+	const uint32_t tableEnd = sizeof(Header) + uint32_t(m_header.buckets) * sizeof(uint16_t)
+							+ uint32_t(m_header.count) * sizeof(Entry);
+	if (tableEnd > m_file.size())
+	{
+		m_header = Header();
+		return latchError(ERROR_PACK_FORMAT);
+	}
+	m_seeds = new uint16_t[m_header.buckets > 0 ? m_header.buckets : 1];
+	m_file.read(m_seeds.get(), uint32_t(m_header.buckets) * sizeof(uint16_t));
+	return latchError(m_header.count);
+}
+
+int32_t ResourcePack::open(const char* name)
+{
+	if (m_header.count == 0)
+		return latchError(ERROR_ASSET_NOT_FOUND);
+
+	// any name hits a slot, the check hash tells whether it's the asset
+	const uint32_t check = hashName(name, 0);
+	const uint16_t seed = m_seeds[check % m_header.buckets];
+	return openEntry(uint16_t(hashName(name, seed) % m_header.count), check, true);
+}
+
+int32_t ResourcePack::openId(uint16_t id)
+{
+	return openEntry(id, 0, false);
+}
+
+int ResourcePack::read(void* data, uint32_t size)
+{
+	if (m_assetPos + size > m_assetSize)
+		return latchError(FlashFS::ERROR_READING_BEYOND_EOF);
+	if (size == 0)
+		return latchError(0);
+
+	m_file.setPos(m_assetStart + m_assetPos);
+	const int result = m_file.read(data, size);
+	if (result < 0)
+		return latchError(result);
+	m_assetPos += size;
+	return latchError(result);
+}
+
+int ResourcePack::latchError(int val)
+{
+	m_lastError = (val < 0) ? val : FlashFS::ERROR_NONE;
+	return val;
+}
+
+int32_t ResourcePack::openEntry(uint16_t id, uint32_t check, bool verify)
+{
+	m_assetSize = m_assetPos = 0;
+	if (id >= m_header.count)
+		return latchError(ERROR_ASSET_NOT_FOUND);
+
+	Entry entry;
+	m_file.setPos(sizeof(Header) + uint32_t(m_header.buckets) * sizeof(uint16_t)
+				+ uint32_t(id) * sizeof(Entry));
+	const int result = m_file.read(entry);
+	if (result < 0)
+		return latchError(result);
+	if (verify && (entry.check != check))
+		return latchError(ERROR_ASSET_NOT_FOUND);
+	if ((entry.offset > m_file.size()) || (entry.size > m_file.size() - entry.offset))
+		return latchError(ERROR_PACK_FORMAT);
+
+	m_assetStart = entry.offset;
+	m_assetSize = entry.size;
+	return latchError(int32_t(entry.size));
+}
+
+}
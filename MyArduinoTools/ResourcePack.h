@@ -0,0 +1,120 @@
+#ifndef OM_RESOURCEPACK_H
+#define OM_RESOURCEPACK_H
+
+#include <stdint.h>
+
+#include "FlashFS.h"
+#include "omMemory.h"
+
+namespace om {
+
+// Read-only pack of many small assets (icons, strings, ...) in a single
+// FlashFS file, built on the host by tools/mkpack. Assets are packed tightly
+// without page alignment. An asset is addressed by its id or by its name
+// through a minimal perfect hash (hash and displace): the seeds of the hash
+// buckets are kept in RAM, thus opening an asset reads its table entry only.
+//
+// header:	[magic 2][count 2][buckets 2][reserved 2]
+// seeds:	buckets x [seed 2]
+// entries:	count x [offset 4][size 4][check 4], id = slot of the hash
+// data:	the assets in id order
+class ResourcePack
+{
+public:
+	static const int ERROR_PACK_FORMAT			= -40;
+	static const int ERROR_ASSET_NOT_FOUND		= -41;
+
+	static const uint16_t MAGIC_PACK			= 0x5052;	// "RP"
+	static const uint8_t BUCKETLOAD				= 4;		// assets per seed
+
+	struct Header
+	{
+		uint16_t	magic;
+		uint16_t	count;
+		uint16_t	buckets;
+		uint16_t	reserved;
+	};
+
+	struct Entry
+	{
+		uint32_t	offset;					// from the start of the pack file
+		uint32_t	size;
+		uint32_t	check;					// hashName(name, 0)
+	};
+
+	// FNV-1a, seeded and finalized. hashName(name, 0) selects the bucket,
+	// hashName(name, seed of the bucket) modulo count the slot.
+	static uint32_t hashName(const char* name, uint16_t seed)
+	{
+		uint32_t hash = 2166136261UL ^ seed;
+		for (; *name != '\0'; ++name)
+		{
+			hash ^= uint8_t(*name);
+			hash *= 16777619UL;
+		}
+		hash ^= hash >> 16;
+		hash *= 0x85EBCA6BUL;
+		hash ^= hash >> 13;
+		return hash;
+	}
+
+	// fileName up to 9 chars.
+	ResourcePack(const char* fileName);
+
+	int	lastError() const
+	{
+		return m_lastError;
+	}
+
+	// opens the pack and loads the seeds (2 bytes per BUCKETLOAD assets).
+	// Returns the number of assets.
+	int begin();
+
+	uint16_t count() const
+	{
+		return m_header.count;
+	}
+
+	// selects an asset for reading by one read of its table entry. Ids are
+	// listed by the header generated with mkpack -H. Returns the asset size.
+	int32_t open(const char* name);
+	int32_t openId(uint16_t id);
+
+	// the selected asset:
+	uint32_t size() const
+	{
+		return m_assetSize;
+	}
+
+	uint32_t pos() const
+	{
+		return m_assetPos;
+	}
+
+	// sequential read within the selected asset
+	int read(void* data, uint32_t size);
+
+	template<typename T>
+	int read(T &data)
+	{
+		return read(&data, sizeof(T));
+	}
+
+private:
+	int latchError(int val);
+	int32_t openEntry(uint16_t id, uint32_t check, bool verify);
+
+	char		m_name[10];
+	Header		m_header{};
+	unique_ptr<uint16_t, _array_destructor> m_seeds;
+	uint32_t	m_assetStart{0};
+	uint32_t	m_assetSize{0};
+	uint32_t	m_assetPos{0};
+
+	File		m_file;
+	int			m_lastError{FlashFS::ERROR_NONE};
+};
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include <Arduino.h>
+
+#include "Serialize.h"
+
+namespace om {
+namespace serialize {
+
+namespace {
+
+uint32_t load(const char* member, uint8_t size)
+{
+	uint32_t value = 0;
+	memcpy(&value, member, (size < sizeof(value)) ? size : sizeof(value));
+	return value;
+}
+
+void store(char* member, uint8_t size, uint32_t value)
+{
+	memcpy(member, &value, (size < sizeof(value)) ? size : sizeof(value));
+}
+
+uint32_t zigzag(uint32_t value, uint8_t size)
+{
+	const int32_t signedValue = (size == 1) ? int32_t(int8_t(value))
+							  : (size == 2) ? int32_t(int16_t(value))
+							  : int32_t(value);
+	return (uint32_t(signedValue) << 1) ^ uint32_t(signedValue >> 31);
+}
+
+uint32_t unzigzag(uint32_t value)
+{
+	return (value >> 1) ^ (0 - (value & 1));
+}
+
+// put(uint8_t) for each byte of the record
+template<typename Put>
+void encode(const char* record, const Field* fields, uint8_t count, Put put)
+{
+	uint8_t bitBuffer = 0;
+	uint8_t bitsUsed = 0;
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		const Field& field = fields[i];
+		const char* member = record + field.offset;
+		if (field.encoding == BITS)
+		{
+			uint32_t value = load(member, field.size);
+			for (uint8_t left = field.bits; left > 0; )
+			{
+				const uint8_t take = (8 - bitsUsed < left) ? 8 - bitsUsed : left;
+				bitBuffer |= uint8_t((value & ((1U << take) - 1)) << bitsUsed);
+				value >>= take;
+				bitsUsed += take;
+				left -= take;
+				if (bitsUsed == 8)
+				{
+					put(bitBuffer);
+					bitBuffer = bitsUsed = 0;
+				}
+			}
+			continue;
+		}
+		if (bitsUsed > 0)
+		{
+			put(bitBuffer);
+			bitBuffer = bitsUsed = 0;
+		}
+
+		if (field.encoding == RAW)
+		{
+			for (uint8_t k = 0; k < field.size; ++k)
+				put(uint8_t(member[k]));
+			continue;
+		}
+		uint32_t value = load(member, field.size);
+		if (field.encoding == SVARINT)
+			value = zigzag(value, field.size);
+		while (value >= 0x80)
+		{
+			put(uint8_t(value) | 0x80);
+			value >>= 7;
+		}
+		put(uint8_t(value));
+	}
+	if (bitsUsed > 0)
+		put(bitBuffer);
+}
+
+// get(uint8_t&) for each byte of the record, false on errors
+template<typename Get>
+int decode(char* record, const Field* fields, uint8_t count, Get get)
+{
+	uint8_t bitBuffer = 0;
+	uint8_t bitsLeft = 0;
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		const Field& field = fields[i];
+		char* member = record + field.offset;
+		if (field.encoding == BITS)
+		{
+			uint32_t value = 0;
+			for (uint8_t done = 0; done < field.bits; )
+			{
+				if ((bitsLeft == 0) && get(bitBuffer))
+					bitsLeft = 8;
+				else if (bitsLeft == 0)
+					return FlashFS::ERROR_READING_BEYOND_EOF;
+				const uint8_t take = (bitsLeft < field.bits - done) ? bitsLeft : field.bits - done;
+				value |= uint32_t(bitBuffer & ((1U << take) - 1)) << done;
+				bitBuffer >>= take;
+				bitsLeft -= take;
+				done += take;
+			}
+			store(member, field.size, value);
+			continue;
+		}
+		bitsLeft = 0;						// the rest of the byte is padding
+
+		uint8_t byte;
+		if (field.encoding == RAW)
+		{
+			for (uint8_t k = 0; k < field.size; ++k)
+			{
+				if (!get(byte))
+					return FlashFS::ERROR_READING_BEYOND_EOF;
+				member[k] = char(byte);
+			}
+			continue;
+		}
+		uint32_t value = 0;
+		for (uint8_t shift = 0; ; shift += 7)
+		{
+			if (shift > 28)
+				return FlashFS::ERROR_RECORD_FORMAT;
+			if (!get(byte))
+				return FlashFS::ERROR_READING_BEYOND_EOF;
+			value |= uint32_t(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				break;
+		}
+		store(member, field.size, (field.encoding == SVARINT) ? unzigzag(value) : value);
+	}
+	return FlashFS::ERROR_NONE;
+}
+
+}
+
+uint16_t encodedSize(const void* record, const Field* fields, uint8_t count)
+{
+	uint16_t size = 0;
+	encode(reinterpret_cast<const char*>(record), fields, count, [&](uint8_t) { ++size; });
+	return size;
+}
+
+uint16_t maxEncodedSize(const Field* fields, uint8_t count)
+{
+	uint16_t size = 0;
+	uint16_t bits = 0;
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		if (fields[i].encoding == BITS)
+		{
+			bits += fields[i].bits;
+			continue;
+		}
+		size += (bits + 7) / 8;
+		bits = 0;
+		size += (fields[i].encoding == RAW) ? fields[i].size : (8 * fields[i].size + 6) / 7;
+	}
+	return size + (bits + 7) / 8;
+}
+
+}
+
+// ==================================================================
+
+int File::writeRecord(const void* record, const serialize::Field* fields, uint8_t count)
+{
+	const uint16_t size = serialize::encodedSize(record, fields, count);
+	if (m_filePos + size > m_fileSize)
+		return latchError(FlashFS::ERROR_WRITING_BEYOND_EOF);
+#ifdef FS_TRACE
+	trace(FlashFS::TRACE_WRITE, m_filePos, size);	// replayed as one write
+#endif
+
+	StreamBuffer stream;
+	int result = streamBegin(stream, size);
+	serialize::encode(reinterpret_cast<const char*>(record), fields, count, [&](uint8_t byte)
+	{
+		if (result >= 0)
+			result = streamOut(stream, &byte, 1);
+	});
+	if (result >= 0)
+		result = streamFlush(stream);
+	return latchError((result < 0) ? result : int(size));
+}
+
+int File::readRecord(void* record, const serialize::Field* fields, uint8_t count)
+{
+	if (m_address == 0x0)
+		return latchError(FlashFS::ERROR_FILE_NOT_OPENED);
+
+	// the record's size is known after decoding only, the position is
+	// corrected behind it then.
+	uint32_t size = serialize::maxEncodedSize(fields, count);
+	if (size > m_fileSize - m_filePos)
+		size = m_fileSize - m_filePos;
+	const uint32_t start = m_filePos;
+	uint16_t consumed = 0;
+
+	StreamBuffer stream;
+	int result = streamBegin(stream, size);
+	if (result >= 0)
+		result = serialize::decode(reinterpret_cast<char*>(record), fields, count, [&](uint8_t &byte)
+		{
+			if (streamIn(stream, &byte, 1) < 0)
+				return false;
+			++consumed;
+			return true;
+		});
+	m_filePos = (result < 0) ? start : start + consumed;
+	return latchError((result < 0) ? result : int(consumed));
+}
+
+}
@@ -0,0 +1,64 @@
+#ifndef OM_SERIALIZE_H
+#define OM_SERIALIZE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "FlashFS.h"
+
+namespace om {
+
+// Compact records for File: instead of sizeof(T) raw bytes (padding and full
+// width integers included) each field is encoded as described by a table of
+// field descriptors. The encoding depends on the descriptors only, never on
+// the struct layout, thus it is the same on AVR and ARM.
+//	struct Sample { uint32_t time; int16_t temp; uint8_t state; bool alarm; };
+//	static const om::serialize::Field sampleFields[] = {
+//		OM_FIELD(Sample, time, UVARINT),
+//		OM_FIELD(Sample, temp, SVARINT),
+//		OM_BITS(Sample, state, 3),
+//		OM_BITS(Sample, alarm, 1) };
+//	om::serialize::write(file, sample, sampleFields);	// e.g. 5 instead of 8 bytes
+namespace serialize {
+
+// encodings, integers of 1, 2 or 4 bytes, little endian
+static const uint8_t RAW			= 0;	// bytes as is, e.g. char arrays, float
+static const uint8_t UVARINT		= 1;	// unsigned, 7 bits per byte
+static const uint8_t SVARINT		= 2;	// signed, zigzag, 7 bits per byte
+static const uint8_t BITS			= 3;	// unsigned, its low bits packed along
+											// with neighbouring BITS fields
+struct Field
+{
+	uint16_t	offset;						// of the member
+	uint8_t		size;						// of the member
+	uint8_t		encoding;
+	uint8_t		bits;						// BITS: 1 ... 32
+};
+
+#define OM_FIELD(Type, member, encoding) \
+	{ uint16_t(offsetof(Type, member)), uint8_t(sizeof(((Type*)0)->member)), om::serialize::encoding, 0 }
+#define OM_BITS(Type, member, bits) \
+	{ uint16_t(offsetof(Type, member)), uint8_t(sizeof(((Type*)0)->member)), om::serialize::BITS, bits }
+
+// bytes taken by record, respectively at most by any record of the fields
+uint16_t encodedSize(const void* record, const Field* fields, uint8_t count);
+uint16_t maxEncodedSize(const Field* fields, uint8_t count);
+
+// at the File's position, see File::writeRecord() and File::readRecord()
+template<typename T, size_t N>
+int write(File &file, const T &record, const Field (&fields)[N])
+{
+	return file.writeRecord(&record, fields, uint8_t(N));
+}
+
+template<typename T, size_t N>
+int read(File &file, T &record, const Field (&fields)[N])
+{
+	return file.readRecord(&record, fields, uint8_t(N));
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,556 @@
+#ifndef OM_CHUNKED_LIST_H
+#define OM_CHUNKED_LIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "omList.h"
+
+namespace om {
+
+// unrolled list: up to N elements per node (chunk), stored contiguously.
+// The links and the allocator's overhead are shared by N elements and
+// iterating walks arrays, jumping to the next chunk every N elements only.
+// push and pop at both ends are constant time, insert() and erase() shift
+// within one chunk, splitting full chunks and merging sparse neighbours.
+// Inserts and erases invalidate the iterators, like for arrays.
+//	chunked_list<uint16_t, 16> ids;		// 2.5 bytes per id on AVR, if full
+template<typename T, size_t N = 8, typename A = heap_allocator>
+class chunked_list : private A
+{
+	static_assert((N > 1) && (N < 256), "chunked_list: 2 ... 255 elements per chunk");
+
+private:
+	struct ChunkBase : list_hook
+	{
+		uint8_t		m_first{0};		///< slot of the first element
+		uint8_t		m_count{0};		///< 0 for the end node only
+	};
+
+	struct Chunk : ChunkBase
+	{
+		alignas(T) char m_storage[N * sizeof(T)];
+
+		T* slot(uint8_t i)
+		{
+			return reinterpret_cast<T*>(m_storage) + i;
+		}
+
+		T* begin()
+		{
+			return slot(this->m_first);
+		}
+
+		T* end()
+		{
+			return slot(this->m_first + this->m_count);
+		}
+	};
+
+	// the end node is a ChunkBase only, never access its slots
+	static Chunk* chunkOf(list_hook* hook)
+	{
+		return static_cast<Chunk*>(static_cast<ChunkBase*>(hook));
+	}
+
+public:
+	static const size_t chunk_size = sizeof(Chunk);
+
+	class iterator
+	{
+	public:
+		iterator()
+		{}
+
+		T &operator*() const
+		{
+			return *m_ptr;
+		}
+
+		T *operator->() const
+		{
+			return m_ptr;
+		}
+
+		bool operator != (const iterator &rhs) const
+		{
+			return m_ptr != rhs.m_ptr;
+		}
+
+		bool operator == (const iterator &rhs) const
+		{
+			return m_ptr == rhs.m_ptr;
+		}
+
+		iterator& operator++()
+		{
+			if (++m_ptr == chunkOf(m_chunk)->end())
+				enter(m_chunk->m_next, true);
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			iterator before(*this);
+			++(*this);
+			return before;
+		}
+
+		iterator& operator--()
+		{
+			if ((m_chunk->m_count == 0) || (m_ptr == chunkOf(m_chunk)->begin()))
+				enter(m_chunk->m_prev, false);
+			else
+				--m_ptr;
+			return *this;
+		}
+
+		iterator operator--(int)
+		{
+			iterator before(*this);
+			--(*this);
+			return before;
+		}
+
+	private:
+		friend class chunked_list;
+		iterator(list_hook* chunk, T* ptr)
+			: m_chunk(static_cast<ChunkBase*>(chunk))
+			, m_ptr(ptr)
+		{}
+
+		// at the first respectively last element of chunk, end() if none
+		void enter(list_hook* chunk, bool first)
+		{
+			m_chunk = static_cast<ChunkBase*>(chunk);
+			if (m_chunk->m_count == 0)
+				m_ptr = nullptr;
+			else
+				m_ptr = first ? chunkOf(m_chunk)->begin() : chunkOf(m_chunk)->end() - 1;
+		}
+
+		ChunkBase*	m_chunk {nullptr};
+		T*			m_ptr {nullptr};		///< nullptr at end()
+	};
+
+	// ========================================================================
+
+	chunked_list(const A &allocator = A())
+		: A(allocator)
+	{}
+
+	chunked_list(const chunked_list &other)
+		: A(other)
+	{
+		for (iterator it = other.begin(); it != other.end(); ++it)
+			emplace_back(*it);
+	}
+
+	chunked_list(chunked_list &&other)
+		: A(other)
+		, m_size(other.m_size)
+		, m_chunks(other.m_chunks)
+	{
+		m_end.take(other.m_end);
+		other.m_size = other.m_chunks = 0;
+	}
+
+	chunked_list& operator=(const chunked_list &other)
+	{
+		if (this == &other)
+			return *this;
+		clear();
+		for (iterator it = other.begin(); it != other.end(); ++it)
+			emplace_back(*it);
+		return *this;
+	}
+
+	chunked_list& operator=(chunked_list &&other)
+	{
+		if (this == &other)
+			return *this;
+		clear();
+		A::operator=(other);
+		m_size = other.m_size;
+		m_chunks = other.m_chunks;
+		m_end.take(other.m_end);
+		other.m_size = other.m_chunks = 0;
+		return *this;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	size_t chunks() const
+	{
+		return m_chunks;
+	}
+
+	size_t memSize() const
+	{
+		return sizeof(chunked_list) + m_chunks * sizeof(Chunk);
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+	iterator begin() const
+	{
+		iterator it;
+		it.enter(m_end.m_next, true);
+		return it;
+	}
+
+	iterator end() const
+	{
+		return iterator(const_cast<ChunkBase*>(&m_end), nullptr);
+	}
+
+	T& front()
+	{
+		return *chunkOf(m_end.m_next)->begin();
+	}
+
+	T& back()
+	{
+		return *(chunkOf(m_end.m_prev)->end() - 1);
+	}
+
+	void push_front(const T &e)
+	{
+		emplace_front(e);
+	}
+
+	void push_front(T &&e)
+	{
+		emplace_front(om::move(e));
+	}
+
+	void push_back(const T &e)
+	{
+		emplace_back(e);
+	}
+
+	void push_back(T &&e)
+	{
+		emplace_back(om::move(e));
+	}
+
+	// an exhausted allocator leaves the list unchanged
+	template<typename... Args>
+	void emplace_front(Args&&... args)
+	{
+		Chunk* chunk = roomInFront();
+		if (chunk == nullptr)
+			return;
+		new (_placement(), chunk->begin() - 1) T(om::forward<Args>(args)...);
+		--chunk->m_first;
+		++chunk->m_count;
+		++m_size;
+	}
+
+	template<typename... Args>
+	void emplace_back(Args&&... args)
+	{
+		Chunk* chunk = roomBehind();
+		if (chunk == nullptr)
+			return;
+		new (_placement(), chunk->end()) T(om::forward<Args>(args)...);
+		++chunk->m_count;
+		++m_size;
+	}
+
+	void pop_front()
+	{
+		Chunk* chunk = chunkOf(m_end.m_next);
+		chunk->begin()->~T();
+		++chunk->m_first;
+		dropOne(chunk);
+	}
+
+	void pop_back()
+	{
+		Chunk* chunk = chunkOf(m_end.m_prev);
+		(chunk->end() - 1)->~T();
+		dropOne(chunk);
+	}
+
+	iterator insert(iterator pos, const T &e)
+	{
+		return emplace(pos, e);
+	}
+
+	iterator insert(iterator pos, T &&e)
+	{
+		return emplace(pos, om::move(e));
+	}
+
+	// returns the new element, end() if the allocator is exhausted
+	template<typename... Args>
+	iterator emplace(iterator pos, Args&&... args)
+	{
+		T value(om::forward<Args>(args)...);	// args may refer to elements moved below
+		Chunk* chunk;
+		uint8_t at;
+		if (pos.m_ptr == nullptr)
+		{
+			chunk = roomBehind();
+			if (chunk == nullptr)
+				return end();
+			at = chunk->m_count;
+		}
+		else
+		{
+			chunk = chunkOf(pos.m_chunk);
+			at = uint8_t(pos.m_ptr - chunk->begin());
+			if (chunk->m_count == N)
+			{
+				// split, the upper half moves into a new chunk behind
+				Chunk* upper = newChunk(chunk->m_next, 0);
+				if (upper == nullptr)
+					return end();
+				const uint8_t keep = N / 2;
+				relocate(chunk->begin() + keep, N - keep, upper->slot(0));
+				upper->m_count = N - keep;
+				chunk->m_count = keep;
+				if (at > keep)
+				{
+					chunk = upper;
+					at -= keep;
+				}
+			}
+		}
+
+		// shift the shorter side having room
+		if (   (chunk->m_first > 0)
+			&& ((chunk->m_first + chunk->m_count == N) || (2 * at < chunk->m_count)))
+		{
+			relocate(chunk->begin(), at, chunk->begin() - 1);
+			--chunk->m_first;
+		}
+		else
+			relocate(chunk->begin() + at, chunk->m_count - at, chunk->begin() + at + 1);
+		new (_placement(), chunk->begin() + at) T(om::move(value));
+		++chunk->m_count;
+		++m_size;
+		return iterator(chunk, chunk->begin() + at);
+	}
+
+	// returns the element behind the erased one
+	iterator erase(iterator pos)
+	{
+		Chunk* chunk = chunkOf(pos.m_chunk);
+		const uint8_t at = uint8_t(pos.m_ptr - chunk->begin());
+		pos.m_ptr->~T();
+		--m_size;
+
+		// close the gap from the shorter side
+		if (2 * at < chunk->m_count)
+		{
+			relocate(chunk->begin(), at, chunk->begin() + 1);
+			++chunk->m_first;
+		}
+		else
+			relocate(chunk->begin() + at + 1, chunk->m_count - at - 1, chunk->begin() + at);
+		--chunk->m_count;
+		return settle(chunk, at);
+	}
+
+	void remove(const T& data)
+	{
+		remove_if([&data](const T &e) { return e == data; });
+	}
+
+	// compacts each chunk in one pass, merging it into its predecessor if
+	// both fit into one
+	template <typename F>
+	void remove_if( F test )
+	{
+		for (list_hook* hook = m_end.m_next; hook != &m_end; )
+		{
+			Chunk* chunk = chunkOf(hook);
+			hook = hook->m_next;
+
+			T* kept = chunk->begin();
+			for (T* scan = chunk->begin(), *end = chunk->end(); scan != end; ++scan)
+			{
+				if (test(*scan))
+				{
+					scan->~T();
+					--m_size;
+				}
+				else
+				{
+					if (kept != scan)
+						relocate(scan, 1, kept);
+					++kept;
+				}
+			}
+			chunk->m_count = uint8_t(kept - chunk->begin());
+
+			ChunkBase* prev = static_cast<ChunkBase*>(chunk->m_prev);
+			if (chunk->m_count == 0)
+				freeChunk(chunk);
+			else if ((prev->m_count > 0) && (prev->m_count + chunk->m_count <= N))
+				absorb(chunkOf(prev), chunk);
+		}
+	}
+
+	iterator find(const T& data) const
+	{
+		for (iterator it = begin(); it != end(); ++it)
+			if (*it == data)
+				return it;
+		return end();
+	}
+
+	template <typename F>
+	iterator find_if( F test ) const
+	{
+		for (iterator it = begin(); it != end(); ++it)
+			if (test(*it))
+				return it;
+		return end();
+	}
+
+	void clear()
+	{
+		while (m_end.m_next != &m_end)
+		{
+			Chunk* chunk = chunkOf(m_end.m_next);
+			for (T* scan = chunk->begin(); scan != chunk->end(); ++scan)
+				scan->~T();
+			m_size -= chunk->m_count;
+			freeChunk(chunk);
+		}
+	}
+
+	~chunked_list()
+	{
+		clear();
+	}
+
+private:
+	// moves count elements into the free slots at to, overlapping or not
+	static void relocate(T* from, uint8_t count, T* to)
+	{
+		if (to < from)
+			for (uint8_t i = 0; i < count; ++i)
+				moveSlot(from + i, to + i);
+		else
+			for (uint8_t i = count; i-- > 0; )
+				moveSlot(from + i, to + i);
+	}
+
+	static void moveSlot(T* from, T* to)
+	{
+		new (_placement(), to) T(om::move(*from));
+		from->~T();
+	}
+
+	// an empty chunk in front of pos, its elements start at slot first
+	Chunk* newChunk(list_hook* pos, uint8_t first)
+	{
+		void* storage = A::allocate(sizeof(Chunk));
+		if (storage == nullptr)
+			return nullptr;
+		Chunk* chunk = new (_placement(), storage) Chunk;	// slots uninitialized
+		chunk->m_first = first;
+		chunk->insert(pos);
+		++m_chunks;
+		return chunk;
+	}
+
+	void freeChunk(Chunk* chunk)
+	{
+		chunk->extract();
+		chunk->~Chunk();
+		A::deallocate(chunk);
+		--m_chunks;
+	}
+
+	// the first chunk, if it has a free slot in front, else a new one
+	Chunk* roomInFront()
+	{
+		ChunkBase* first = static_cast<ChunkBase*>(m_end.m_next);
+		if ((first->m_count > 0) && (first->m_first > 0))
+			return chunkOf(first);
+		return newChunk(m_end.m_next, N);
+	}
+
+	// the last chunk, if it has a free slot behind, else a new one
+	Chunk* roomBehind()
+	{
+		ChunkBase* last = static_cast<ChunkBase*>(m_end.m_prev);
+		if ((last->m_count > 0) && (last->m_first + last->m_count < N))
+			return chunkOf(last);
+		return newChunk(&m_end, 0);
+	}
+
+	// after destroying the element at either end of chunk
+	void dropOne(Chunk* chunk)
+	{
+		--m_size;
+		if (--chunk->m_count == 0)
+			freeChunk(chunk);
+	}
+
+	// appends the elements of from to into, which has room for them
+	void absorb(Chunk* into, Chunk* from)
+	{
+		if (size_t(into->m_first) + into->m_count + from->m_count > N)
+		{
+			relocate(into->begin(), into->m_count, into->slot(0));
+			into->m_first = 0;
+		}
+		relocate(from->begin(), from->m_count, into->end());
+		into->m_count += from->m_count;
+		freeChunk(from);
+	}
+
+	// after an erase from chunk: frees it if empty, merges it with a
+	// neighbour if it's less than half full and both fit into one. Returns
+	// the position of the element at of chunk.
+	iterator settle(Chunk* chunk, uint8_t at)
+	{
+		iterator it;
+		if (chunk->m_count == 0)
+		{
+			list_hook* next = chunk->m_next;
+			freeChunk(chunk);
+			it.enter(next, true);
+			return it;
+		}
+
+		ChunkBase* next = static_cast<ChunkBase*>(chunk->m_next);
+		ChunkBase* prev = static_cast<ChunkBase*>(chunk->m_prev);
+		if (2 * chunk->m_count >= N)
+			;
+		else if ((next->m_count > 0) && (chunk->m_count + next->m_count <= N))
+			absorb(chunk, chunkOf(next));
+		else if ((prev->m_count > 0) && (prev->m_count + chunk->m_count <= N))
+		{
+			at += prev->m_count;
+			absorb(chunkOf(prev), chunk);
+			chunk = chunkOf(prev);
+		}
+
+		if (at == chunk->m_count)
+			it.enter(chunk->m_next, true);
+		else
+			it = iterator(chunk, chunk->begin() + at);
+		return it;
+	}
+
+	size_t		m_size{0};		///< elements
+	size_t		m_chunks{0};
+	ChunkBase	m_end;			///< links first and last chunk, represents end()
+};
+
+}
+
+#endif
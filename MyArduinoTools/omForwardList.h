@@ -0,0 +1,395 @@
+#ifndef OM_FORWARD_LIST_H
+#define OM_FORWARD_LIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "omList.h"
+
+namespace om {
+
+// singly linked list: one pointer per node instead of two, e.g. 4 instead
+// of 6 bytes per uint16_t on AVR. Elements are inserted and erased behind
+// a position, before_begin() allows for the first one. A provides the
+// nodes like for om::list, lists exchanging nodes share the allocator.
+template<typename T, typename A = heap_allocator>
+class forward_list : private A
+{
+private:
+	struct NodeBase
+	{
+		NodeBase*	m_next {nullptr};
+	};
+
+	struct Node : NodeBase
+	{
+		T m_data;
+
+		template<typename... Args>
+		Node(Args&&... args)
+			: NodeBase()
+			, m_data(om::forward<Args>(args)...)
+		{}
+	};
+
+public:
+	static const size_t node_size = sizeof(Node);
+
+	class iterator
+	{
+	public:
+		iterator()
+		{}
+
+		T &operator*() const
+		{
+			return reinterpret_cast<Node*>(m_node)->m_data;
+		}
+
+		T *operator->() const
+		{
+			return &(reinterpret_cast<Node*>(m_node)->m_data);
+		}
+
+		bool operator != (const iterator &rhs) const
+		{
+			return m_node != rhs.m_node;
+		}
+
+		bool operator == (const iterator &rhs) const
+		{
+			return m_node == rhs.m_node;
+		}
+
+		iterator& operator++()
+		{
+			m_node = m_node->m_next;
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			iterator before(*this);
+			m_node = m_node->m_next;
+			return before;
+		}
+
+	private:
+		friend class forward_list;
+		iterator(NodeBase *ptr)
+			: m_node(ptr)
+		{}
+
+		NodeBase *m_node {nullptr};
+	};
+
+	// ========================================================================
+
+	forward_list(const A &allocator = A())
+		: A(allocator)
+	{}
+
+	forward_list(const forward_list &other)
+		: A(other)
+	{
+		copyFrom(other);
+	}
+
+	forward_list(forward_list &&other)
+		: A(other)
+		, m_size(other.m_size)
+	{
+		m_head.m_next = other.m_head.m_next;
+		other.m_head.m_next = nullptr;
+		other.m_size = 0;
+	}
+
+	forward_list& operator=(const forward_list &other)
+	{
+		if (this == &other)
+			return *this;
+		clear();
+		copyFrom(other);
+		return *this;
+	}
+
+	forward_list& operator=(forward_list &&other)
+	{
+		if (this == &other)
+			return *this;
+		clear();
+		A::operator=(other);
+		m_size = other.m_size;
+		m_head.m_next = other.m_head.m_next;
+		other.m_head.m_next = nullptr;
+		other.m_size = 0;
+		return *this;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	size_t memSize() const
+	{
+		return sizeof(forward_list) + size() * sizeof(Node);
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+	// position in front of the first element, for insert_after() and
+	// erase_after() only
+	iterator before_begin() const
+	{
+		return iterator(const_cast<NodeBase*>(&m_head));
+	}
+
+	iterator begin() const
+	{
+		return iterator(m_head.m_next);
+	}
+
+	iterator end() const
+	{
+		return iterator(nullptr);
+	}
+
+	T& front()
+	{
+		return reinterpret_cast<Node*>(m_head.m_next)->m_data;
+	}
+
+	void push_front(const T &e)
+	{
+		emplaceNode(&m_head, e);
+	}
+
+	void push_front(T &&e)
+	{
+		emplaceNode(&m_head, om::move(e));
+	}
+
+	template<typename... Args>
+	void emplace_front(Args&&... args)
+	{
+		emplaceNode(&m_head, om::forward<Args>(args)...);
+	}
+
+	void pop_front()
+	{
+		destroyNode(unlinkAfter(&m_head));
+	}
+
+	// the inserts return the new element, end() if the allocator is exhausted
+	iterator insert_after(iterator pos, const T &e)
+	{
+		return iterator(emplaceNode(pos.m_node, e));
+	}
+
+	iterator insert_after(iterator pos, T &&e)
+	{
+		return iterator(emplaceNode(pos.m_node, om::move(e)));
+	}
+
+	template<typename... Args>
+	iterator emplace_after(iterator pos, Args&&... args)
+	{
+		return iterator(emplaceNode(pos.m_node, om::forward<Args>(args)...));
+	}
+
+	// returns the element behind the erased one
+	iterator erase_after(iterator pos)
+	{
+		destroyNode(unlinkAfter(pos.m_node));
+		return iterator(pos.m_node->m_next);
+	}
+
+	// erases the elements between first and last, both excluded
+	iterator erase_after(iterator first, iterator last)
+	{
+		while (first.m_node->m_next != last.m_node)
+			destroyNode(unlinkAfter(first.m_node));
+		return last;
+	}
+
+	// moves the elements of other behind pos
+	void splice_after(iterator pos, forward_list &other)
+	{
+		splice_after(pos, other, other.before_begin(), other.end());
+	}
+
+	// moves the element behind it
+	void splice_after(iterator pos, forward_list &other, iterator it)
+	{
+		if ((pos == it) || (pos.m_node == it.m_node->m_next))
+			return;
+		linkAfter(other.unlinkAfter(it.m_node), pos.m_node);
+	}
+
+	// moves the elements between first and last, both excluded
+	void splice_after(iterator pos, forward_list &other, iterator first, iterator last)
+	{
+		if (pos == first)
+			return;
+		NodeBase* tail = pos.m_node;
+		while (first.m_node->m_next != last.m_node)
+			tail = linkAfter(other.unlinkAfter(first.m_node), tail);
+	}
+
+	// stable, see sort_chain()
+	void sort()
+	{
+		sort(_less<T>());
+	}
+
+	template<typename F>
+	void sort( F lessThan )
+	{
+		m_head.m_next = sort_chain<Node>(m_head.m_next, lessThan);
+	}
+
+	// moves the nodes of other into this list, both sorted. Stable, equal
+	// elements of this list come first.
+	void merge(forward_list &other)
+	{
+		merge(other, _less<T>());
+	}
+
+	template<typename F>
+	void merge(forward_list &other, F lessThan)
+	{
+		if (&other == this)
+			return;
+		m_head.m_next = merge_chains<Node>(m_head.m_next, other.m_head.m_next, lessThan);
+		m_size += other.m_size;
+		other.m_head.m_next = nullptr;
+		other.m_size = 0;
+	}
+
+	void remove(const T& data)
+	{
+		for (NodeBase* prev = &m_head; prev->m_next != nullptr; )
+		{
+			if (valueOf(prev->m_next) == data)
+				destroyNode(unlinkAfter(prev));
+			else
+				prev = prev->m_next;
+		}
+	}
+
+	template <typename F>
+	void remove_if( F test )
+	{
+		for (NodeBase* prev = &m_head; prev->m_next != nullptr; )
+		{
+			if ( test(valueOf(prev->m_next)) )
+				destroyNode(unlinkAfter(prev));
+			else
+				prev = prev->m_next;
+		}
+	}
+
+	void unique()
+	{
+		for(NodeBase* scan = m_head.m_next; scan != nullptr; scan = scan->m_next)
+			while ((scan->m_next != nullptr) && (valueOf(scan) == valueOf(scan->m_next)))
+				destroyNode(unlinkAfter(scan));
+	}
+
+	template <typename F>
+	void unique( F equal )
+	{
+		for(NodeBase* scan = m_head.m_next; scan != nullptr; scan = scan->m_next)
+			while ((scan->m_next != nullptr) && equal(valueOf(scan), valueOf(scan->m_next)))
+				destroyNode(unlinkAfter(scan));
+	}
+
+	iterator find(const T& data) const
+	{
+		for(NodeBase* scan = m_head.m_next; scan != nullptr; scan = scan->m_next)
+			if ( valueOf(scan) == data )
+				return iterator(scan);
+		return end();
+	}
+
+	template <typename F>
+	iterator find_if( F test ) const
+	{
+		for(NodeBase* scan = m_head.m_next; scan != nullptr; scan = scan->m_next)
+			if ( test(valueOf(scan)) )
+				return iterator(scan);
+		return end();
+	}
+
+	void clear()
+	{
+		while(m_head.m_next != nullptr)
+			destroyNode(unlinkAfter(&m_head));
+	}
+
+	~forward_list()
+	{
+		clear();
+	}
+
+private:
+	static const T& valueOf(const NodeBase* node)
+	{
+		return reinterpret_cast<Node const*>(node)->m_data;
+	}
+
+	void copyFrom(const forward_list &other)
+	{
+		NodeBase* tail = &m_head;
+		for(NodeBase* scan = other.m_head.m_next; scan != nullptr; scan = scan->m_next)
+		{
+			NodeBase* node = emplaceNode(tail, valueOf(scan));
+			if (node == nullptr)
+				break;
+			tail = node;
+		}
+	}
+
+	// an exhausted allocator leaves the list unchanged, returning nullptr
+	template<typename... Args>
+	NodeBase* emplaceNode(NodeBase* pos, Args&&... args)
+	{
+		void* storage = A::allocate(sizeof(Node));
+		if (storage == nullptr)
+			return nullptr;
+		return linkAfter(new (_placement(), storage) Node(om::forward<Args>(args)...), pos);
+	}
+
+	void destroyNode(NodeBase* node)
+	{
+		static_cast<Node*>(node)->~Node();
+		A::deallocate(node);
+	}
+
+	NodeBase* linkAfter(NodeBase* node, NodeBase* pos)
+	{
+		++m_size;
+		node->m_next = pos->m_next;
+		pos->m_next = node;
+		return node;
+	}
+
+	NodeBase* unlinkAfter(NodeBase* pos)
+	{
+		--m_size;
+		NodeBase* node = pos->m_next;
+		pos->m_next = node->m_next;
+		return node;
+	}
+
+	size_t   m_size{0};	///< counted at links and unlinks
+	NodeBase m_head;	///< virtual Node in front of the first, before_begin()
+};
+
+}
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef OM_INTRUSIVE_LIST_H
+#define OM_INTRUSIVE_LIST_H
+
+#include <stddef.h>
+
+#include "omList.h"
+
+namespace om {
+
+// A list of objects living elsewhere (static, pool, stack), linked through
+// a list_hook member: no allocation, no copy, constant time insert, erase
+// and splice. An object with several hooks can be in several lists at once.
+//	struct Timer { uint32_t due; list_hook byDue; list_hook byOwner; };
+//	intrusive_list<Timer, &Timer::byDue> pending;
+// The list doesn't own its elements: erase them before they're destroyed.
+// An element is in at most one list per hook, inserting a linked one
+// leaves it where it is.
+template<typename T, list_hook T::*Hook>
+class intrusive_list
+{
+public:
+	class iterator
+	{
+	public:
+		iterator()
+		{}
+
+		T &operator*() const
+		{
+			return *element(m_hook);
+		}
+
+		T *operator->() const
+		{
+			return element(m_hook);
+		}
+
+		bool operator != (const iterator &rhs) const
+		{
+			return m_hook != rhs.m_hook;
+		}
+
+		bool operator == (const iterator &rhs) const
+		{
+			return m_hook == rhs.m_hook;
+		}
+
+		iterator& operator++()
+		{
+			m_hook = m_hook->m_next;
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			iterator before(*this);
+			m_hook = m_hook->m_next;
+			return before;
+		}
+
+		iterator& operator--()
+		{
+			m_hook = m_hook->m_prev;
+			return *this;
+		}
+
+		iterator operator--(int)
+		{
+			iterator before(*this);
+			m_hook = m_hook->m_prev;
+			return before;
+		}
+
+	private:
+		friend class intrusive_list;
+		iterator(list_hook *ptr)
+			: m_hook(ptr)
+		{}
+
+		list_hook *m_hook {nullptr};
+	};
+
+	// ========================================================================
+
+	intrusive_list()
+	{}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+	iterator begin() const
+	{
+		return iterator(m_end.m_next);
+	}
+
+	iterator end() const
+	{
+		return iterator(const_cast<list_hook*>(&m_end));
+	}
+
+	// the position of e, which is in this list
+	iterator iterator_to(T &e) const
+	{
+		return iterator(&(e.*Hook));
+	}
+
+	T& front()
+	{
+		return *element(m_end.m_next);
+	}
+
+	T& back()
+	{
+		return *element(m_end.m_prev);
+	}
+
+	void push_front(T &e)
+	{
+		link(e, m_end.m_next);
+	}
+
+	void push_back(T &e)
+	{
+		link(e, &m_end);
+	}
+
+	// returns end(), if e is in a list already
+	iterator insert(iterator pos, T &e)
+	{
+		return iterator(link(e, pos.m_hook));
+	}
+
+	void pop_front()
+	{
+		unlink(m_end.m_next);
+	}
+
+	void pop_back()
+	{
+		unlink(m_end.m_prev);
+	}
+
+	// returns the position behind the erased element
+	iterator erase(iterator pos)
+	{
+		list_hook* next = pos.m_hook->m_next;
+		unlink(pos.m_hook);
+		return iterator(next);
+	}
+
+	// e is in this list
+	void erase(T &e)
+	{
+		unlink(&(e.*Hook));
+	}
+
+	void splice(iterator pos, intrusive_list &other)
+	{
+		while(other.m_size > 0)
+		{
+			list_hook* hook = other.m_end.m_next;
+			other.unlink(hook);
+			relink(hook, pos.m_hook);
+		}
+	}
+
+	void splice(iterator pos, intrusive_list &other, iterator it)
+	{
+		if (pos == it)
+			return;
+		other.unlink(it.m_hook);
+		relink(it.m_hook, pos.m_hook);
+	}
+
+	// unlinks all elements, they may be inserted elsewhere then
+	void clear()
+	{
+		while(m_end.m_next != &m_end)
+			unlink(m_end.m_next);
+	}
+
+	~intrusive_list()
+	{
+		clear();
+	}
+
+	intrusive_list(const intrusive_list &other) = delete;
+	intrusive_list& operator=(const intrusive_list &other) = delete;
+
+private:
+	static T* element(list_hook* hook)
+	{
+		// offsetof() for the pointer to member
+		const size_t offset = reinterpret_cast<size_t>(&(static_cast<T*>(nullptr)->*Hook));
+		return reinterpret_cast<T*>(reinterpret_cast<char*>(hook) - offset);
+	}
+
+	list_hook* link(T &e, list_hook* pos)
+	{
+		list_hook* hook = &(e.*Hook);
+		if (hook->linked())
+			return &m_end;
+		relink(hook, pos);
+		return hook;
+	}
+
+	void relink(list_hook* hook, list_hook* pos)
+	{
+		++m_size;
+		hook->insert(pos);
+	}
+
+	// leaves the hook unlinked, ready for the next insert
+	void unlink(list_hook* hook)
+	{
+		--m_size;
+		hook->extract();
+		hook->clear();
+	}
+
+	size_t		m_size{0};
+	list_hook	m_end;		///< links first and last, represents end()
+};
+
+}
+
+#endif
@@ -2,78 +2,159 @@
 #define OM_LIST_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "omMemory.h"
 
 namespace om {
 
-template<typename T>
-class list
+// the links of a list element: the base of om::list's nodes and, embedded
+// into objects, the hook of om::intrusive_list (omIntrusiveList.h). The
+// links belong to the list the element is in, copies are in no list.
+struct list_hook
 {
-private:
-	struct NodeBase
+	list_hook*	m_prev {nullptr};
+	list_hook*	m_next {nullptr};
+
+	list_hook()
+		: m_prev(this)
+		, m_next(this)
+	{ }
+
+	list_hook(const list_hook&)
+		: list_hook()
+	{ }
+
+	list_hook& operator=(const list_hook&)
 	{
-		NodeBase*	m_prev {nullptr};
-		NodeBase*	m_next {nullptr};
+		return *this;
+	}
 
-		NodeBase()
-			: m_prev(this)
-			, m_next(this)
-		{ }
+	bool linked() const
+	{
+		return m_next != this;
+	}
 
-		NodeBase(const NodeBase& other)
-			: m_prev(other.m_prev)
-			, m_next(other.m_next)
-		{ }
+	// takes over the nodes linked to other, leaving it empty
+	void take(list_hook &other)
+	{
+		if (other.m_next == &other)
+			return clear();
+		m_prev = other.m_prev;
+		m_next = other.m_next;
+		m_prev->m_next = this;
+		m_next->m_prev = this;
+		other.clear();
+	}
 
-		NodeBase(NodeBase &&other)
-			: m_prev(other.m_prev)
-			, m_next(other.m_next)
-		{ other.clear(); }
+	void clear()
+	{
+		m_prev = this;
+		m_next = this;
+	}
 
-		NodeBase move()
-		{
-			NodeBase copy(*this);
-			clear();
-			return copy;
-		}
+	void extract()
+	{
+		m_prev->m_next = m_next;
+		m_next->m_prev = m_prev;
+	}
 
-		void clear()
-		{
-			m_prev = this;
-			m_next = this;
-		}
+	void insert(list_hook* at)
+	{
+		m_next = at;
+		m_prev = at->m_prev;
+
+		m_next->m_prev = this;
+		m_prev->m_next = this;
+	}
+};
+
+// the default order of sort() and merge()
+template<typename T>
+struct _less
+{
+	bool operator()(const T &a, const T &b) const
+	{
+		return a < b;
+	}
+};
+
+// merges the null terminated chains of m_next, left wins on equal elements.
+// Node is the node type holding the element m_data, Link its base.
+template<typename Node, typename Link, typename F>
+Link* merge_chains(Link* left, Link* right, F &lessThan)
+{
+	Link* head = nullptr;
+	Link** tail = &head;
+	while ((left != nullptr) && (right != nullptr))
+	{
+		Link*& first = lessThan(static_cast<Node const*>(right)->m_data,
+								static_cast<Node const*>(left)->m_data) ? right : left;
+		*tail = first;
+		tail = &first->m_next;
+		first = first->m_next;
+	}
+	*tail = (left != nullptr) ? left : right;
+	return head;
+}
 
-		void extract()
+// stable merge sort of a null terminated chain of m_next, relinking the
+// nodes without allocation. Bottom-up: run[i] is empty or a sorted run of
+// 2^i nodes, older than the runs below. Merged like a binary counter.
+template<typename Node, typename Link, typename F>
+Link* sort_chain(Link* head, F &lessThan)
+{
+	Link* run[sizeof(size_t) * 8] = {};
+	uint8_t runs = 0;
+	while (head != nullptr)
+	{
+		Link* carry = head;
+		head = head->m_next;
+		carry->m_next = nullptr;
+
+		uint8_t i = 0;
+		for ( ; run[i] != nullptr; ++i)
 		{
-			m_prev->m_next = m_next;
-			m_next->m_prev = m_prev;
+			carry = merge_chains<Node>(run[i], carry, lessThan);
+			run[i] = nullptr;
 		}
+		run[i] = carry;
+		if (i >= runs)
+			runs = i + 1;
+	}
 
-		void insert(NodeBase* at)
-		{
-			m_next = at;
-			m_prev = at->m_prev;
+	Link* sorted = nullptr;
+	for (uint8_t i = 0; i < runs; ++i)
+		if (run[i] != nullptr)
+			sorted = (sorted != nullptr) ? merge_chains<Node>(run[i], sorted, lessThan) : run[i];
+	return sorted;
+}
 
-			m_next->m_prev = this;
-			m_prev->m_next = this;
-		}
-	};
+// A provides the storage of the nodes, e.g. a pool_allocator for constant
+// time inserts and erases without heap traffic. Lists exchanging nodes by
+// splice() need to share the allocator.
+template<typename T, typename A = heap_allocator>
+class list : private A		// empty allocators take no space
+{
+private:
+	typedef list_hook NodeBase;
 
 	struct Node : NodeBase
 	{
 		T m_data;
 
-		Node(const T &e)
-			: NodeBase()
-			, m_data(e)
-		{}
-
-		Node(T &&e)
+		// T constructed in place from args, copied or moved from a T
+		template<typename... Args>
+		Node(Args&&... args)
 			: NodeBase()
-			, m_data(e)
+			, m_data(om::forward<Args>(args)...)
 		{}
 	};
 
 public:
+	// block size of a pool for this list
+	static const size_t node_size = sizeof(Node);
+
 	class iterator
 	{
 	public:
@@ -100,26 +181,26 @@ public:
 			return m_node == rhs.m_node;
 		}
 
-		iterator& operator++(int)
+		iterator& operator++()
 		{
 			m_node = m_node->m_next;
 			return *this;
 		}
 
-		iterator operator++()
+		iterator operator++(int)
 		{
 			iterator before(*this);
 			m_node = m_node->m_next;
 			return before;
 		}
 
-		iterator& operator--(int)
+		iterator& operator--()
 		{
 			m_node = m_node->m_prev;
 			return *this;
 		}
 
-		iterator operator--()
+		iterator operator--(int)
 		{
 			iterator before(*this);
 			m_node = m_node->m_prev;
@@ -161,7 +242,7 @@ public:
 		}
 
 	private:
-		friend class list<T>;
+		friend class list;
 		iterator(NodeBase *ptr)
 			: m_node(ptr)
 		{}
@@ -171,21 +252,47 @@ public:
 
 	// ========================================================================
 
-	list()
+	list(const A &allocator = A())
+		: A(allocator)
 	{}
 
-	list(const list<T> &other)
+	list(const list &other)
+		: A(other)
 	{
 		insert(end(), other.begin(), other.end());
 	}
 
-	list(list<T> &&other)
-		: m_size(other.m_size)
-		, m_end(other.m_end.move())
+	list(list &&other)
+		: A(other)
+		, m_size(other.m_size)
 	{
+		m_end.take(other.m_end);
 		other.m_size  = 0;
 	}
 
+	// keeps its allocator, the elements are copied
+	list& operator=(const list &other)
+	{
+		if (this == &other)
+			return *this;
+		clear();
+		insert(end(), other.begin(), other.end());
+		return *this;
+	}
+
+	// takes the nodes and the allocator of other, no element is touched
+	list& operator=(list &&other)
+	{
+		if (this == &other)
+			return *this;
+		clear();
+		A::operator=(other);
+		m_size = other.m_size;
+		m_end.take(other.m_end);
+		other.m_size = 0;
+		return *this;
+	}
+
 	size_t size() const
 	{
 		return m_size;
@@ -193,7 +300,7 @@ public:
 
 	size_t memSize() const
 	{
-		return sizeof(list<T>) + size() * sizeof(Node);
+		return sizeof(list) + size() * sizeof(Node);
 	}
 
 	iterator begin() const
@@ -211,17 +318,17 @@ public:
 	void resize(size_t count)
 	{
 		while(m_size > count)
-			delete unlink(m_end.m_prev);
-		while(m_size < count)
-			insertElement(T{}, &m_end);
+			destroyNode(unlink(m_end.m_prev));
+		while((m_size < count) && (emplaceNode(&m_end) != &m_end))
+			;
 	}
 
 	void resize(size_t count, const T& value)
 	{
 		while(m_size > count)
-			delete unlink(m_end.m_prev);
-		while(m_size < count)
-			insertElement(value, &m_end);
+			destroyNode(unlink(m_end.m_prev));
+		while((m_size < count) && (emplaceNode(&m_end, value) != &m_end))
+			;
 	}
 
 	bool empty() const
@@ -241,53 +348,77 @@ public:
 
 	void push_front(const T &e)
 	{
-		insertElement(e, m_end.m_next);
+		emplaceNode(m_end.m_next, e);
 	}
 
 	void push_front(T &&e)
 	{
-		insertElement(e, m_end.m_next);
+		emplaceNode(m_end.m_next, om::move(e));
 	}
 
 	void push_back(const T &e)
 	{
-		insertElement(e, &m_end);
+		emplaceNode(&m_end, e);
 	}
 
 	void push_back(T &&e)
 	{
-		insertElement(e, &m_end);
+		emplaceNode(&m_end, om::move(e));
+	}
+
+	// T constructed in the node from args, no temporary
+	template<typename... Args>
+	void emplace_front(Args&&... args)
+	{
+		emplaceNode(m_end.m_next, om::forward<Args>(args)...);
+	}
+
+	template<typename... Args>
+	void emplace_back(Args&&... args)
+	{
+		emplaceNode(&m_end, om::forward<Args>(args)...);
+	}
+
+	template<typename... Args>
+	iterator emplace(iterator pos, Args&&... args)
+	{
+		return iterator(emplaceNode(pos.m_node, om::forward<Args>(args)...));
 	}
 
 	iterator insert(iterator pos, const T &e)
 	{
-		return iterator(insertElement(e, pos.m_node));
+		return iterator(emplaceNode(pos.m_node, e));
+	}
+
+	iterator insert(iterator pos, T &&e)
+	{
+		return iterator(emplaceNode(pos.m_node, om::move(e)));
 	}
 
 	void insert(iterator pos, size_t count, const T &e)
 	{
 		while (count-- > 0)
-			insertElement(e, pos.m_node);
+			emplaceNode(pos.m_node, e);
 	}
 
 	void insert(iterator pos, iterator first, iterator last)
 	{
 		for(NodeBase* scan = first.m_node; scan != last.m_node; scan = scan->m_next)
-			insertElement(reinterpret_cast<Node*>(scan)->m_data, pos.m_node);
+			emplaceNode(pos.m_node, reinterpret_cast<Node*>(scan)->m_data);
 	}
 
-	void splice(iterator pos, list<T> &other)
+	void splice(iterator pos, list &other)
 	{
 		while(other.m_size > 0)
 			insertNode(other.unlink(other.m_end.m_next), pos.m_node);
 	}
 
-	void splice(iterator pos, list<T> &other, iterator it)
+	void splice(iterator pos, list &other, iterator it)
 	{
 		insertNode(other.unlink(it.m_node), pos.m_node);
 	}
 
-	void splice(iterator pos, list<T> &other, iterator first, iterator last)
+	void splice(iterator pos, list &other, iterator first, iterator last)
 	{
 		while(first != last)
 		{
@@ -297,70 +428,69 @@ public:
 		}
 	}
 
+	// stable merge sort relinking the nodes, no allocation
 	void sort()
 	{
-		for (bool sorted = false; !sorted; )
+		sort(_less<T>());
+	}
+
+	template<typename F>
+	void sort( F lessThan )
+	{
+		if (m_size < 2)
+			return;
+
+		m_end.m_prev->m_next = nullptr;
+		NodeBase* sorted = sort_chain<Node>(m_end.m_next, lessThan);
+
+		// restore the backward links
+		NodeBase* prev = &m_end;
+		for ( ; sorted != nullptr; sorted = sorted->m_next)
 		{
-			sorted = true;	// give it a try
-			NodeBase* stopAtMax = &m_end;
-			for (NodeBase* scan = m_end.m_next; scan != stopAtMax; )
-			{
-				NodeBase* next = scan->m_next;
-				if (   (next != &m_end)
-					&& (  reinterpret_cast<Node*>(next)->m_data
-						< reinterpret_cast<Node*>(scan)->m_data))
-				{
-					// swap and move maximum to end
-					insertNode(unlink(next), scan);
-					sorted = false;		// ... need a verification run
-				}
-				else if (next == stopAtMax)
-					stopAtMax = scan;	// ... and exit loop
-				else
-					scan = next;
-			}
+			prev->m_next = sorted;
+			sorted->m_prev = prev;
+			prev = sorted;
 		}
+		prev->m_next = &m_end;
+		m_end.m_prev = prev;
+	}
+
+	// moves the nodes of other into this list, both sorted. Stable, equal
+	// elements of this list come first. Linear time, the lists need to share
+	// the allocator like with splice().
+	void merge(list &other)
+	{
+		merge(other, _less<T>());
 	}
 
 	template<typename F>
-	void sort( F lessThan )
+	void merge(list &other, F lessThan)
 	{
-		for (bool sorted = false; !sorted; )
+		if (&other == this)
+			return;
+		NodeBase* pos = m_end.m_next;
+		while(other.m_size > 0)
 		{
-			sorted = true;	// give it a try
-			NodeBase* stopAtMax = &m_end;
-			for (NodeBase* scan = m_end.m_next; scan != stopAtMax; )
-			{
-				NodeBase* next = scan->m_next;
-				if (    (next != &m_end)
-				     && lessThan( reinterpret_cast<Node*>(next)->m_data
-								, reinterpret_cast<Node*>(scan)->m_data))
-				{
-					// swap and move maximum to end
-					insertNode(unlink(next), scan);
-					sorted = false;		// ... need a verification run
-				}
-				else if (next == stopAtMax)
-					stopAtMax = scan;	// ... and exit loop
-				else
-					scan = next;
-			}
+			NodeBase* node = other.m_end.m_next;
+			while ((pos != &m_end) && !lessThan(valueOf(node), valueOf(pos)))
+				pos = pos->m_next;
+			insertNode(other.unlink(node), pos);
 		}
 	}
 
 	void pop_front()
 	{
-		delete unlink(m_end.m_next);
+		destroyNode(unlink(m_end.m_next));
 	}
 
 	void pop_back()
 	{
-		delete unlink(m_end.m_prev);
+		destroyNode(unlink(m_end.m_prev));
 	}
 
 	void erase(iterator pos)
 	{
-		delete unlink(pos.m_node);
+		destroyNode(unlink(pos.m_node));
 	}
 
 	void erase(iterator first, iterator last)
@@ -369,7 +499,7 @@ public:
 		{
 			NodeBase* toRemove = first.m_node;
 			++first;
-			delete unlink(toRemove);
+			destroyNode(unlink(toRemove));
 		}
 	}
 
@@ -405,7 +535,7 @@ public:
 			{
 				if (   reinterpret_cast<Node*>(scan)->m_data 
 					== reinterpret_cast<Node*>(next)->m_data )
-					delete unlink(next);
+					destroyNode(unlink(next));
 				else
 					break;	// done on this element
 			}
@@ -419,7 +549,7 @@ public:
 			{
 				if (equal( reinterpret_cast<Node const*>(scan)->m_data 
 						 , reinterpret_cast<Node const*>(next)->m_data ))
-					delete unlink(next);
+					destroyNode(unlink(next));
 				else
 					break;	// done on this element
 			}
@@ -462,7 +592,7 @@ public:
 	void clear()
 	{
 		while(m_end.m_next != &m_end)
-			delete unlink(m_end.m_next);
+			destroyNode(unlink(m_end.m_next));
 	}
 
 	~list()
@@ -471,14 +601,20 @@ public:
 	}
 
 private:
-	NodeBase* insertElement(const T &e, NodeBase* pos)
+	// an exhausted allocator leaves the list unchanged, inserting at end()
+	template<typename... Args>
+	NodeBase* emplaceNode(NodeBase* pos, Args&&... args)
 	{
-		return insertNode(new Node(e), pos);
+		void* storage = A::allocate(sizeof(Node));
+		if (storage == nullptr)
+			return &m_end;
+		return insertNode(new (_placement(), storage) Node(om::forward<Args>(args)...), pos);
 	}
 
-	NodeBase* insertElement(T &&e, NodeBase* pos)
+	void destroyNode(NodeBase* node)
 	{
-		return insertNode(new Node(e), pos);
+		static_cast<Node*>(node)->~Node();
+		A::deallocate(node);
 	}
 
 	NodeBase* insertNode(NodeBase* node, NodeBase* pos)
@@ -495,10 +631,15 @@ private:
 		return node;
 	}
 
+	static const T& valueOf(const NodeBase* node)
+	{
+		return reinterpret_cast<Node const*>(node)->m_data;
+	}
+
 	NodeBase* eraseAndNext(NodeBase* node)
 	{
 		NodeBase* next = node->m_next;
-		delete unlink(node);
+		destroyNode(unlink(node));
 		return next;
 	}
 
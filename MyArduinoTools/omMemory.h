@@ -1,13 +1,47 @@
 #ifndef OM_MEMORY_H
 #define OM_MEMORY_H
 
+#include <stddef.h>
 #include <stdlib.h>
 
+namespace om {
+struct _placement {};
+}
+
+// placement new without depending on <new>, which AVR cores lack
+inline void* operator new(size_t, om::_placement, void* ptr)
+{
+	return ptr;
+}
+
 namespace om {
 
 // provides some lightweight stl replacements
 extern int debug;
 
+template<typename T> struct _remove_reference		{ typedef T type; };
+template<typename T> struct _remove_reference<T&>	{ typedef T type; };
+template<typename T> struct _remove_reference<T&&>	{ typedef T type; };
+
+// std::move() and std::forward() without <utility>, call them qualified
+template<typename T>
+typename _remove_reference<T>::type&& move(T &&value)
+{
+	return static_cast<typename _remove_reference<T>::type&&>(value);
+}
+
+template<typename T>
+T&& forward(typename _remove_reference<T>::type &value)
+{
+	return static_cast<T&&>(value);
+}
+
+template<typename T>
+T&& forward(typename _remove_reference<T>::type &&value)
+{
+	return static_cast<T&&>(value);
+}
+
 template<typename T>
 void _element_destructor(T* ptr)
 {
@@ -47,7 +81,8 @@ public:
 
 	unique_ptr& operator=(unique_ptr &&other)
 	{
-		reset(other.m_ptr);
+		if (this != &other)
+			reset(other.release());
 		return *this;
 	}
 
@@ -121,6 +156,184 @@ private:
 	T*	m_ptr{nullptr};
 };
 
+// allocators of containers (e.g. om::list<T, A>) hand out raw storage for
+// one element: allocate() returns nullptr, if there is none left.
+struct heap_allocator
+{
+	static void* allocate(size_t size)
+	{
+		return ::operator new(size);
+	}
+
+	static void deallocate(void* ptr)
+	{
+		::operator delete(ptr);
+	}
+};
+
+// strictest alignment of fundamental types: 1 on AVR, 8 on ARM
+union _max_align
+{
+	long long	l;
+	long double	d;
+	void*		p;
+};
+
+// fixed-size blocks without heap traffic after construction: the free blocks
+// are chained through their first bytes, thus allocate() and deallocate()
+// are constant time pointer swaps and never fragment.
+class pool
+{
+public:
+	// blocks of blockSize, rounded up to the alignment, from the heap once
+	pool(size_t blockSize, size_t count)
+		: m_blockSize(roundUp(blockSize))
+		, m_capacity(count)
+	{
+		m_heapStorage = static_cast<char*>(malloc(m_blockSize * count));
+		if (!m_heapStorage)
+			m_capacity = 0;
+		chain(m_heapStorage.get());
+	}
+
+	// blocks in storage of count x roundUp(blockSize) bytes, e.g. static
+	pool(void* storage, size_t blockSize, size_t count)
+		: m_blockSize(roundUp(blockSize))
+		, m_capacity(count)
+	{
+		chain(static_cast<char*>(storage));
+	}
+
+	static constexpr size_t roundUp(size_t blockSize)
+	{
+		return (blockSize < sizeof(void*))
+			 ? roundUp(sizeof(void*))
+			 : (blockSize + alignof(_max_align) - 1) / alignof(_max_align) * alignof(_max_align);
+	}
+
+	void* allocate(size_t size)
+	{
+		if ((m_free == nullptr) || (size > m_blockSize))
+		{
+			++m_failed;
+			return nullptr;
+		}
+		Block* block = m_free;
+		m_free = block->next;
+		if (++m_used > m_peak)
+			m_peak = m_used;
+		return block;
+	}
+
+	void deallocate(void* ptr)
+	{
+		if (ptr == nullptr)
+			return;
+		Block* block = static_cast<Block*>(ptr);
+		block->next = m_free;
+		m_free = block;
+		--m_used;
+	}
+
+	// statistics
+	size_t blockSize() const
+	{
+		return m_blockSize;
+	}
+
+	size_t capacity() const
+	{
+		return m_capacity;
+	}
+
+	size_t used() const
+	{
+		return m_used;
+	}
+
+	size_t peak() const
+	{
+		return m_peak;
+	}
+
+	// allocations refused, since exhausted or too large
+	size_t failed() const
+	{
+		return m_failed;
+	}
+
+	pool(const pool &other) = delete;
+	pool& operator=(const pool &other) = delete;
+
+private:
+	struct Block
+	{
+		Block*	next;
+	};
+
+	void chain(char* storage)
+	{
+		for (size_t i = m_capacity; i-- > 0; )
+		{
+			Block* block = reinterpret_cast<Block*>(storage + i * m_blockSize);
+			block->next = m_free;
+			m_free = block;
+		}
+	}
+
+	size_t		m_blockSize;
+	size_t		m_capacity;
+	size_t		m_used{0};
+	size_t		m_peak{0};
+	size_t		m_failed{0};
+	Block*		m_free{nullptr};
+	unique_ptr<char, _allocs_destructor> m_heapStorage;
+};
+
+// pool with static storage, e.g. for 32 nodes of om::list<Event>:
+//	static_pool<list<Event>::node_size, 32> eventPool;
+template<size_t BlockSize, size_t Count>
+class static_pool : public pool
+{
+public:
+	static_pool()
+		: pool(m_storage, BlockSize, Count)
+	{
+	}
+
+private:
+	alignas(_max_align) char m_storage[Count * pool::roundUp(BlockSize)];
+};
+
+// allocator handing out the blocks of a pool, shared by all its users:
+//	list<Event, pool_allocator> events(eventPool);
+class pool_allocator
+{
+public:
+	pool_allocator(pool &blocks)
+		: m_pool(&blocks)
+	{
+	}
+
+	void* allocate(size_t size) const
+	{
+		return m_pool->allocate(size);
+	}
+
+	void deallocate(void* ptr) const
+	{
+		m_pool->deallocate(ptr);
+	}
+
+	bool operator==(const pool_allocator &other) const
+	{
+		return m_pool == other.m_pool;
+	}
+
+private:
+	pool*	m_pool;
+};
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,467 @@
+// fsreplay: replays a FlashFS trace (FS_TRACE, see FlashFS.h) on the host.
+// The traced operations run through FlashFS.cpp itself against an EEPROM in
+// memory (see tools/mkflashfs/Wire.h), whose bus traffic feeds a timing
+// model: 9 clocks per byte and 2 per start/stop, plus the write cycle time
+// per program cycle. Built with FS_NOR_DEVICE_SIZE and FS_NOR_CS_PIN, the
+// trace runs through NorFlashFS.cpp on a SPI NOR flash in memory (see
+// tools/mkflashfs/SPI.h) instead: 8 clocks per byte, plus the page program
+// and sector erase times. Reports bus time, program cycles, erases and
+// fragmentation of the free space over the replayed operations. Built with
+// FS_TRACE, -t records the replayed operations as a trace again: replaying
+// that one reproduces the counts, a round trip of recording and replay.
+//
+// usage: fsreplay [-c clock] [-w writeCycle] [-e eraseTime] [-i interval] [-t out] trace
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "FlashFS.h"
+
+HardwareSerial Serial;
+TwoWire Wire;
+HostEeprom hostEeprom;
+
+#ifdef FS_NOR_DEVICE_SIZE
+#include <SPI.h>
+
+SPIClass SPI;
+HostNor hostNor;
+
+void digitalWrite(uint8_t, uint8_t value)
+{
+	hostNor.select(value == LOW);
+}
+#endif
+
+namespace {
+
+typedef om::FlashFS FS;
+
+struct Model
+{
+	uint32_t	clock;						// Hz
+	double		writeCycle;					// ms
+	double		eraseTime;					// ms
+};
+
+struct Traffic
+{
+	uint32_t	count;
+	uint32_t	transactions;
+	uint32_t	bytes;
+	uint32_t	programCycles;
+	uint32_t	erases;
+};
+
+struct Fragmentation
+{
+	uint32_t	free;
+	uint32_t	largest;					// gap
+};
+
+#ifdef FS_TRACE
+class TraceFile : public Print
+{
+public:
+	using Print::write;
+
+	size_t write(uint8_t data) override
+	{
+		return fputc(data, file) == EOF ? 0 : 1;
+	}
+
+	size_t write(const uint8_t* data, size_t size) override
+	{
+		return fwrite(data, 1, size, file);
+	}
+
+	FILE*		file{nullptr};
+};
+#endif
+
+void usage()
+{
+	fprintf(stderr, "usage: fsreplay [-c clock] [-w writeCycle] [-e eraseTime] [-i interval] [-t out] trace\n"
+#ifdef FS_NOR_DEVICE_SIZE
+					"  -c  SPI clock in Hz (default 8000000)\n"
+					"  -w  page program time in ms (default 0.7)\n"
+					"  -e  sector erase time in ms (default 45)\n"
+#else
+					"  -c  I2C clock in Hz (default 100000)\n"
+					"  -w  write cycle time in ms (default 5)\n"
+#endif
+					"  -i  report every interval operations (default 100)\n"
+					"  -t  records the replayed operations (build with -DFS_TRACE)\n");
+}
+
+#ifdef FS_NOR_DEVICE_SIZE
+Traffic traffic()
+{
+	const Traffic now = { 0, hostNor.m_transactions, hostNor.m_bytes
+						, hostNor.m_programs, hostNor.m_erases };
+	return now;
+}
+
+double busTime(const Model& model, const Traffic& traffic)
+{
+	return traffic.bytes * 8.0 * 1000.0 / model.clock;
+}
+#else
+Traffic traffic()
+{
+	const Traffic now = { 0, hostEeprom.m_transactions, hostEeprom.m_bytes
+						, hostEeprom.m_programCycles, 0 };
+	return now;
+}
+
+double busTime(const Model& model, const Traffic& traffic)
+{
+	return (traffic.bytes * 9.0 + traffic.transactions * 2.0) * 1000.0 / model.clock;
+}
+#endif
+
+double totalTime(const Model& model, const Traffic& traffic)
+{
+	return busTime(model, traffic) + traffic.programCycles * model.writeCycle
+								   + traffic.erases * model.eraseTime;
+}
+
+// free space behind the directory, as seen by the allocation
+Fragmentation fragmentation(uint32_t deviceSize, uint16_t pageSize)
+{
+	const uint32_t mask = ~uint32_t(pageSize - 1);
+	std::vector<std::pair<uint32_t, uint32_t> > extents;
+	for (int i = 0; i < flashFs.numFiles(); ++i)
+	{
+		const auto entry = flashFs.fileEntry(i);
+		const uint32_t size = std::max(entry->size, uint32_t(1));
+		extents.push_back(std::make_pair(entry->startAddress
+									   , (entry->startAddress + size + pageSize - 1) & mask));
+	}
+	std::sort(extents.begin(), extents.end());
+
+	Fragmentation result = { 0, 0 };
+	uint32_t end = (FS::directorySize() + pageSize - 1) & mask;
+	extents.push_back(std::make_pair(deviceSize, deviceSize));
+	for (const auto& extent : extents)
+	{
+		if (extent.first > end)
+		{
+			result.free += extent.first - end;
+			result.largest = std::max(result.largest, extent.first - end);
+		}
+		end = std::max(end, extent.second);
+	}
+	return result;
+}
+
+void report(const Model& model, uint32_t ops, const FS::TraceStart& start)
+{
+	const Fragmentation frag = fragmentation(start.deviceSize, start.pageSize);
+	const Traffic now = traffic();
+	printf("%8u %11.1f %9.1f %8u %7u %5d %8u %8u %5.1f%%\n"
+		  , ops, totalTime(model, now), busTime(model, now), now.programCycles
+		  , now.erases, flashFs.numFiles(), frag.free, frag.largest
+		  , frag.free ? 100.0 * (frag.free - frag.largest) / frag.free : 0.0);
+}
+
+bool readTrace(const char* path, std::vector<char>& trace)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == nullptr)
+		return false;
+	char buffer[4096];
+	for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0; )
+		trace.insert(trace.end(), buffer, buffer + n);
+	const bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+uint8_t payloadSize(uint8_t op)
+{
+	switch (op)
+	{
+	case FS::TRACE_START:		return sizeof(FS::TraceStart);
+	case FS::TRACE_FORMAT:
+	case FS::TRACE_CREATE:
+	case FS::TRACE_OPEN:
+	case FS::TRACE_DELETE:
+	case FS::TRACE_RESIZE:
+	case FS::TRACE_UPDATE:
+	case FS::TRACE_PIN:
+	case FS::TRACE_UNPIN:		return sizeof(FS::TraceName);
+	case FS::TRACE_COMMIT:
+	case FS::TRACE_ABORT:
+	case FS::TRACE_CLEAN:
+	case FS::TRACE_FLUSH:
+	case FS::TRACE_WRITE:
+	case FS::TRACE_READ:		return sizeof(FS::TraceData);
+	case FS::TRACE_BATCH:
+	case FS::TRACE_COMMITBATCH:	return 0;
+	}
+	return 0xFF;	// unknown
+}
+
+}
+
+int main(int argc, char** argv)
+{
+#ifdef FS_NOR_DEVICE_SIZE
+	Model model = { 8000000, 0.7, 45.0 };
+#else
+	Model model = { 100000, 5.0, 0.0 };
+#endif
+	uint32_t interval = 100;
+	const char* recordName = nullptr;
+
+	for (int opt; (opt = getopt(argc, argv, "c:w:e:i:t:")) != -1; )
+	{
+		switch (opt)
+		{
+		case 'c': model.clock = strtoul(optarg, nullptr, 0);		break;
+		case 'w': model.writeCycle = strtod(optarg, nullptr);		break;
+		case 'e': model.eraseTime = strtod(optarg, nullptr);		break;
+		case 'i': interval = strtoul(optarg, nullptr, 0);			break;
+		case 't': recordName = optarg;								break;
+		default:  usage();											return 1;
+		}
+	}
+	std::vector<char> trace;
+	if ((optind + 1 != argc) || (model.clock == 0) || (interval == 0))
+	{
+		usage();
+		return 1;
+	}
+	if (!readTrace(argv[optind], trace))
+	{
+		fprintf(stderr, "fsreplay: can't read %s\n", argv[optind]);
+		return 1;
+	}
+#ifdef FS_TRACE
+	TraceFile record;
+	if ((recordName != nullptr) && ((record.file = fopen(recordName, "wb")) == nullptr))
+	{
+		fprintf(stderr, "fsreplay: can't write %s\n", recordName);
+		return 1;
+	}
+#else
+	if (recordName != nullptr)
+	{
+		fprintf(stderr, "fsreplay: -t requires a build with -DFS_TRACE\n");
+		return 1;
+	}
+#endif
+
+	std::vector<uint8_t> memory;
+	std::map<uint32_t, om::File> files;		// by traced start address
+	std::map<uint8_t, Traffic> perOp;
+	std::vector<char> data;
+	FS::TraceStart start = {};
+	uint32_t ops = 0;
+	uint32_t failed = 0;
+	uint32_t diverged = 0;
+	size_t at = 0;
+
+	printf("     ops    time[ms]   bus[ms]   cycles  erases files     free  largest  frag\n");
+	while (at < trace.size())
+	{
+		const uint8_t op = trace[at];
+		const uint8_t size = payloadSize(op);
+		if ((size == 0xFF) || (at + 1 + size > trace.size()))
+		{
+			fprintf(stderr, "fsreplay: %s record at offset %zu\n"
+						  , (size == 0xFF) ? "corrupt" : "truncated", at);
+			break;
+		}
+		const char* payload = &trace[at + 1];
+		at += 1 + size;
+
+		if (op == FS::TRACE_START)
+		{
+			// the traced state, with the content unknown: written data is
+			// random, the free space is erased
+			memcpy(&start, payload, sizeof(start));
+			if ((start.dirSize > FS::directorySize()) || (at + start.dirSize > trace.size()))
+			{
+				fprintf(stderr, "fsreplay: truncated trace start at offset %zu\n", at);
+				return 1;
+			}
+			memory.assign(start.deviceSize, 0xFF);
+			memcpy(memory.data(), &trace[at], start.dirSize);
+			at += start.dirSize;
+#ifdef FS_NOR_DEVICE_SIZE
+			hostNor.setGeometry(memory.data(), start.deviceSize);
+			const HostNor counted = hostNor;		// mounting isn't traced
+			const bool mounted = flashFs.openDevice(0x50, start.deviceSize, start.pageSize);
+#ifdef FS_TRACE
+			if (mounted && (record.file != nullptr))
+				flashFs.startTrace(record);
+#endif
+			hostNor.m_transactions = counted.m_transactions;
+			hostNor.m_bytes = counted.m_bytes;
+#else
+			hostEeprom.setGeometry(memory.data(), start.deviceSize, start.pageSize);
+			const HostEeprom counted = hostEeprom;	// mounting isn't traced
+			const bool mounted = flashFs.openDevice(0x50, start.deviceSize, start.pageSize);
+#ifdef FS_TRACE
+			if (mounted && (record.file != nullptr))
+				flashFs.startTrace(record);
+#endif
+			hostEeprom.m_transactions = counted.m_transactions;
+			hostEeprom.m_bytes = counted.m_bytes;
+#endif
+			if (!mounted)
+			{
+				fprintf(stderr, "fsreplay: unsupported FlashFS version %x or geometry %u / %u\n"
+							  , start.version, start.deviceSize, start.pageSize);
+				return 1;
+			}
+			for (int i = 0; i < flashFs.numFiles(); ++i)
+			{
+				const auto entry = flashFs.fileEntry(i);
+				for (uint32_t k = 0; k < entry->written; ++k)
+					memory[entry->startAddress + k] = rand();
+			}
+			files.clear();
+			continue;
+		}
+		if (memory.empty())
+		{
+			fprintf(stderr, "fsreplay: trace doesn't start with a directory\n");
+			return 1;
+		}
+
+		FS::TraceName name;
+		FS::TraceData access;
+		if (size == sizeof(FS::TraceName))
+			memcpy(&name, payload, sizeof(name));
+		else if (size == sizeof(FS::TraceData))
+			memcpy(&access, payload, sizeof(access));
+
+		const Traffic before = traffic();
+		int result = FS::ERROR_NONE;
+		switch (op)
+		{
+		case FS::TRACE_FORMAT:
+			flashFs.format(name.name);
+			files.clear();
+			break;
+		case FS::TRACE_CREATE:
+			result = files[name.address].createFile(name.name, name.size);
+			break;
+		case FS::TRACE_OPEN:
+			result = files[name.address].openFile(name.name);
+			break;
+		case FS::TRACE_DELETE:
+			result = flashFs.deleteFile(name.name);
+			break;
+		case FS::TRACE_RESIZE:
+			result = flashFs.resizeFile(name.name, name.size);
+			break;
+		case FS::TRACE_UPDATE:
+			result = files[name.address].beginUpdate(name.name, name.size);
+			break;
+		case FS::TRACE_COMMIT:
+			result = files[access.address].commitUpdate();
+			break;
+		case FS::TRACE_ABORT:
+			files[access.address].close();
+			break;
+		case FS::TRACE_CLEAN:
+			result = files[access.address].cleanFile(access.arg);
+			break;
+		case FS::TRACE_FLUSH:
+			result = files[access.address].flush();
+			break;
+		case FS::TRACE_WRITE:
+		case FS::TRACE_READ:
+		{
+			om::File& file = files[access.address];
+			if (data.size() < access.arg)
+				data.resize(access.arg);
+			// changing data: flash can't program it over the old one
+			for (uint32_t k = 0; (op == FS::TRACE_WRITE) && (k < access.arg); ++k)
+				data[k] = rand();
+			file.setPos(access.pos);
+			result = (op == FS::TRACE_WRITE) ? file.write(data.data(), access.arg)
+											 : file.read(data.data(), access.arg);
+			break;
+		}
+		case FS::TRACE_BATCH:
+			flashFs.beginBatch();
+			break;
+		case FS::TRACE_COMMITBATCH:
+			flashFs.commitBatch();
+			break;
+#ifdef FS_PIN_BUDGET
+		case FS::TRACE_PIN:
+			result = flashFs.pin(name.name);
+			break;
+		case FS::TRACE_UNPIN:
+			result = flashFs.unpin(name.name);
+			break;
+#else
+		case FS::TRACE_PIN:
+		case FS::TRACE_UNPIN:
+			result = FS::ERROR_PIN_BUDGET;	// build with -DFS_PIN_BUDGET
+			break;
+#endif
+		}
+		if (result < 0)
+			++failed;
+
+		// the same operations on the same directory allocate alike
+		if ((op == FS::TRACE_CREATE) || (op == FS::TRACE_OPEN))
+			for (int i = 0; i < flashFs.numFiles(); ++i)
+				if (   (strcmp(flashFs.fileEntry(i)->name, name.name) == 0)
+					&& (flashFs.fileEntry(i)->startAddress != name.address)
+					&& (diverged++ == 0))
+					fprintf(stderr, "fsreplay: %s allocated at 0x%06x instead of 0x%06x\n"
+								  , name.name, flashFs.fileEntry(i)->startAddress, name.address);
+
+		const Traffic after = traffic();
+		Traffic& total = perOp[op];
+		++total.count;
+		total.transactions += after.transactions - before.transactions;
+		total.bytes += after.bytes - before.bytes;
+		total.programCycles += after.programCycles - before.programCycles;
+		total.erases += after.erases - before.erases;
+
+		if (++ops % interval == 0)
+			report(model, ops, start);
+	}
+	if (memory.empty())
+	{
+		fprintf(stderr, "fsreplay: empty trace\n");
+		return 1;
+	}
+	if (ops % interval != 0)
+		report(model, ops, start);
+#ifdef FS_TRACE
+	flashFs.stopTrace();
+	if ((record.file != nullptr) && (fclose(record.file) != 0))
+	{
+		fprintf(stderr, "fsreplay: can't write %s\n", recordName);
+		return 1;
+	}
+#endif
+
+	printf("\nop    count transactions      bytes   cycles  erases   time[ms]\n");
+	for (const auto& total : perOp)
+		printf("%c  %8u %12u %10u %8u %7u %10.1f\n"
+			  , total.first, total.second.count, total.second.transactions
+			  , total.second.bytes, total.second.programCycles, total.second.erases
+			  , totalTime(model, total.second));
+	printf("\n%u operations, %u failed, %u allocations diverged\n", ops, failed, diverged);
+#ifdef FS_NOR_DEVICE_SIZE
+	printf("%u NOR flash rule violations\n", hostNor.m_violations);
+#endif
+	return 0;
+}
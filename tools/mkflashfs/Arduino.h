@@ -0,0 +1,78 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// host shim: just enough Arduino to build FlashFS.cpp for mkflashfs and
+// fsreplay
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the output of FS_TRACE (flashFs.startTrace())
+class Print
+{
+public:
+	virtual ~Print()
+	{
+	}
+
+	virtual size_t write(uint8_t data) = 0;
+
+	virtual size_t write(const uint8_t* data, size_t size)
+	{
+		size_t done = 0;
+		while ((done < size) && (write(data[done]) == 1))
+			++done;
+		return done;
+	}
+};
+
+class HardwareSerial : public Print
+{
+public:
+	using Print::write;
+
+	size_t write(uint8_t data) override
+	{
+		return fputc(data, stderr) == EOF ? 0 : 1;
+	}
+
+	size_t print(const char* text)
+	{
+		return fputs(text, stderr) < 0 ? 0 : strlen(text);
+	}
+
+	size_t println(const char* text = "")
+	{
+		return print(text) + print("\n");
+	}
+
+	size_t println(long value)
+	{
+		char text[12];
+		snprintf(text, sizeof(text), "%ld", value);
+		return println(text);
+	}
+};
+
+extern HardwareSerial Serial;
+
+// pacing the page program cycles isn't necessary for the image
+inline void delay(unsigned long)
+{
+}
+
+// pins: the chip select of the SPI NOR flash in memory (see SPI.h)
+#define LOW		0
+#define HIGH	1
+#define OUTPUT	1
+
+inline void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value);
+
+#endif
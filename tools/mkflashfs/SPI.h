@@ -0,0 +1,148 @@
+#ifndef SPI_H
+#define SPI_H
+
+// host shim: a SPI NOR flash in memory, enforcing its rules: sector erase
+// to 0xFF, programming clears bits only, page program wraps around within
+// 256 bytes, both only after write enable. Violations are counted, as is
+// the traffic for the timing model of fsreplay. The flash is never busy.
+// The tool routes digitalWrite() of the chip select to select().
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MSBFIRST	1
+#define SPI_MODE0	0
+
+class HostNor
+{
+public:
+	void setGeometry(uint8_t* memory, uint32_t deviceSize)
+	{
+		m_memory = memory;
+		m_deviceSize = deviceSize;
+	}
+
+	void select(bool selected)
+	{
+		if (selected)
+		{
+			m_length = 0;
+			++m_transactions;
+			return;
+		}
+		if (m_length == 0)
+			return;
+
+		// commands are executed by raising CS
+		switch (m_command)
+		{
+		case 0x06:	// write enable
+			m_writeEnabled = true;
+			break;
+		case 0x02:	// page program
+			if (!m_writeEnabled || (m_length < 5))
+			{
+				++m_violations;
+				break;
+			}
+			++m_programs;
+			for (uint32_t i = 0; i < m_length - 4; ++i)
+			{
+				const uint32_t at = (m_address & ~uint32_t(0xFF)) | ((m_address + i) & 0xFF);
+				if (m_page[i] & ~m_memory[at])
+					++m_violations;			// bits can't be set
+				m_memory[at] &= m_page[i];
+			}
+			m_writeEnabled = false;
+			break;
+		case 0x20:	// sector erase
+			if (!m_writeEnabled || (m_length != 4))
+			{
+				++m_violations;
+				break;
+			}
+			++m_erases;
+			for (uint32_t i = 0; i < 4096; ++i)
+				m_memory[(m_address & ~uint32_t(4095)) + i] = 0xFF;
+			m_writeEnabled = false;
+			break;
+		}
+	}
+
+	uint8_t transfer(uint8_t data)
+	{
+		++m_bytes;
+		const uint32_t at = m_length++;
+		if (at == 0)
+		{
+			m_command = data;
+			m_address = 0;
+			return 0xFF;
+		}
+		if (m_command == 0x05)	// read status: never busy
+			return m_writeEnabled ? 0x02 : 0x00;
+		if (at < 4)
+		{
+			m_address = ((m_address << 8) | data) & (m_deviceSize - 1);
+			return 0xFF;
+		}
+		if (m_command == 0x03)	// read, rolling over at the end
+			return m_memory[(m_address + at - 4) & (m_deviceSize - 1)];
+		if ((m_command == 0x02) && (at - 4 < 256))
+			m_page[at - 4] = data;
+		else if (m_command == 0x02)
+			++m_violations;			// the real device would wrap around
+		return 0xFF;
+	}
+
+	uint8_t*	m_memory{nullptr};
+	uint32_t	m_deviceSize{0};
+
+	// traffic
+	uint32_t	m_transactions{0};
+	uint32_t	m_bytes{0};
+	uint32_t	m_programs{0};
+	uint32_t	m_erases{0};
+	uint32_t	m_violations{0};
+
+private:
+	uint8_t		m_command{0};
+	uint32_t	m_address{0};
+	uint32_t	m_length{0};
+	bool		m_writeEnabled{false};
+	uint8_t		m_page[256];
+};
+
+extern HostNor hostNor;
+
+struct SPISettings
+{
+	SPISettings(uint32_t, uint8_t, uint8_t)
+	{
+	}
+};
+
+class SPIClass
+{
+public:
+	void begin()
+	{
+	}
+
+	void beginTransaction(SPISettings)
+	{
+	}
+
+	void endTransaction()
+	{
+	}
+
+	uint8_t transfer(uint8_t data)
+	{
+		return hostNor.transfer(data);
+	}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+// host shim: an I2C EEPROM in memory, addressed like the real device
+// (address bytes inline, higher address bits P0..P2 in the device address).
+// The bus traffic is counted for the timing model of fsreplay.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef BUFFER_LENGTH
+	#define BUFFER_LENGTH	32
+#endif
+
+class HostEeprom
+{
+public:
+	void setGeometry(uint8_t* memory, uint32_t deviceSize, uint16_t pageSize)
+	{
+		m_memory = memory;
+		m_deviceSize = deviceSize;
+		m_pageSize = pageSize;
+		m_addressBytes = (deviceSize > (uint32_t(1) << 11)) ? 2 : 1;
+	}
+
+	uint8_t*	m_memory{nullptr};
+	uint32_t	m_deviceSize{0};
+	uint16_t	m_pageSize{0};
+	uint8_t		m_addressBytes{2};
+	uint32_t	m_current{0};
+
+	// traffic
+	uint32_t	m_transactions{0};
+	uint32_t	m_bytes{0};					// incl. device address bytes
+	uint32_t	m_programCycles{0};
+};
+
+extern HostEeprom hostEeprom;
+
+class TwoWire
+{
+public:
+	void begin()
+	{
+	}
+
+	void beginTransmission(uint8_t address)
+	{
+		m_device = address;
+		m_length = 0;
+	}
+
+	size_t write(int data)
+	{
+		if (m_length >= BUFFER_LENGTH)
+			return 0;
+		m_buffer[m_length++] = uint8_t(data);
+		return 1;
+	}
+
+	uint8_t endTransmission(bool = true)
+	{
+		HostEeprom& eeprom = hostEeprom;
+		++eeprom.m_transactions;
+		eeprom.m_bytes += 1 + m_length;
+		if (m_length < eeprom.m_addressBytes)
+			return 2;	// nack, e.g. probing
+		if (m_length > eeprom.m_addressBytes)
+			++eeprom.m_programCycles;
+
+		// P0..P2 continue the inline address bits
+		uint32_t address = m_device & 0x07;
+		for (uint8_t i = 0; i < eeprom.m_addressBytes; ++i)
+			address = (address << 8) | m_buffer[i];
+		eeprom.m_current = address & (eeprom.m_deviceSize - 1);
+
+		// page write, rolling over within the page
+		const uint32_t page = eeprom.m_current & ~uint32_t(eeprom.m_pageSize - 1);
+		uint32_t offset = eeprom.m_current - page;
+		for (uint16_t i = eeprom.m_addressBytes; i < m_length; ++i)
+		{
+			eeprom.m_memory[page + offset] = m_buffer[i];
+			offset = (offset + 1) & (eeprom.m_pageSize - 1);
+		}
+		return 0;
+	}
+
+	uint8_t requestFrom(int, int quantity)
+	{
+		HostEeprom& eeprom = hostEeprom;
+		m_length = 0;
+		m_readPos = 0;
+		++eeprom.m_transactions;
+		eeprom.m_bytes += 1;
+		for (; (m_length < quantity) && (m_length < BUFFER_LENGTH); ++m_length)
+		{
+			m_buffer[m_length] = eeprom.m_memory[eeprom.m_current];
+			eeprom.m_current = (eeprom.m_current + 1) & (eeprom.m_deviceSize - 1);
+		}
+		eeprom.m_bytes += m_length;
+		return m_length;
+	}
+
+	int available()
+	{
+		return m_length - m_readPos;
+	}
+
+	int read()
+	{
+		return (m_readPos < m_length) ? m_buffer[m_readPos++] : -1;
+	}
+
+private:
+	uint8_t		m_device{0};
+	uint8_t		m_buffer[BUFFER_LENGTH];
+	uint16_t	m_length{0};
+	uint16_t	m_readPos{0};
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,171 @@
+// mkflashfs: builds a FlashFS volume image from a directory of files on the
+// host. The volume is formatted and filled by FlashFS.cpp itself, running on
+// an EEPROM in memory (see Wire.h), thus the image is byte-exact.
+//
+// usage: mkflashfs [-s deviceSize] [-p pageSize] [-n name] [-f] -o image dir
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "FlashFS.h"
+
+HardwareSerial Serial;
+TwoWire Wire;
+HostEeprom hostEeprom;
+
+namespace {
+
+void usage()
+{
+	fprintf(stderr, "usage: mkflashfs [-s deviceSize] [-p pageSize] [-n name] [-f] -o image dir\n"
+					"  -s  device size in bytes, 2048 ... 262144 (default 32768)\n"
+					"  -p  page size in bytes (default 64)\n"
+					"  -n  storage name, up to 9 chars (default FLASHFS)\n"
+					"  -f  image of the whole device, else up to the last used page\n");
+}
+
+bool isPowerOf2(uint32_t value)
+{
+	return (value > 0) && ((value & (value - 1)) == 0);
+}
+
+bool readFile(const std::string& path, std::vector<char>& content)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		return false;
+	content.clear();
+	char buffer[4096];
+	for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0; )
+		content.insert(content.end(), buffer, buffer + n);
+	const bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t deviceSize = EEPROMSize32k;
+	uint16_t pageSize = 64;
+	const char* storageName = "FLASHFS";
+	const char* imageName = nullptr;
+	bool fullImage = false;
+
+	for (int opt; (opt = getopt(argc, argv, "s:p:n:o:f")) != -1; )
+	{
+		switch (opt)
+		{
+		case 's': deviceSize = strtoul(optarg, nullptr, 0);	break;
+		case 'p': pageSize = strtoul(optarg, nullptr, 0);	break;
+		case 'n': storageName = optarg;						break;
+		case 'o': imageName = optarg;						break;
+		case 'f': fullImage = true;							break;
+		default:  usage();									return 1;
+		}
+	}
+	if ((imageName == nullptr) || (optind + 1 != argc))
+	{
+		usage();
+		return 1;
+	}
+	if (   !isPowerOf2(deviceSize) || (deviceSize < EEPROMSize2k) || (deviceSize > EEPROMSize256k)
+		|| !isPowerOf2(pageSize) || (pageSize < 8) || (pageSize > 256))
+	{
+		fprintf(stderr, "mkflashfs: unsupported geometry %u / %u\n", deviceSize, pageSize);
+		return 1;
+	}
+
+	// collect the files, sorted by name for reproducible images
+	const std::string source = argv[optind];
+	std::vector<std::string> names;
+	DIR* dir = opendir(source.c_str());
+	if (dir == nullptr)
+	{
+		fprintf(stderr, "mkflashfs: can't open %s\n", source.c_str());
+		return 1;
+	}
+	while (const dirent* entry = readdir(dir))
+	{
+		struct stat info;
+		const std::string path = source + "/" + entry->d_name;
+		if ((stat(path.c_str(), &info) == 0) && S_ISREG(info.st_mode))
+			names.push_back(entry->d_name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+
+	// erased EEPROM, formatted by FlashFS itself
+	std::vector<uint8_t> memory(deviceSize, 0xFF);
+	hostEeprom.setGeometry(memory.data(), deviceSize, pageSize);
+	flashFs.openDevice(0x50, deviceSize, pageSize);
+	flashFs.format(storageName);
+
+	flashFs.beginBatch();
+	for (const std::string& name : names)
+	{
+		std::vector<char> content;
+		if (name.size() > 9)
+		{
+			fprintf(stderr, "mkflashfs: name too long: %s\n", name.c_str());
+			return 1;
+		}
+		if (!readFile(source + "/" + name, content))
+		{
+			fprintf(stderr, "mkflashfs: can't read %s\n", name.c_str());
+			return 1;
+		}
+
+		om::File file;
+		int result = file.createFile(name.c_str(), content.size());
+		if ((result >= 0) && !content.empty())
+			result = file.write(content.data(), content.size());
+		if (result < 0)
+		{
+			fprintf(stderr, "mkflashfs: %s: error %d\n", name.c_str(), result);
+			return 1;
+		}
+		printf("%-9s %7zu\n", name.c_str(), content.size());
+	}
+	flashFs.commitBatch();
+	if (flashFs.numFiles() != int(names.size()))
+	{
+		fprintf(stderr, "mkflashfs: %d files in the directory instead of %zu\n"
+					  , flashFs.numFiles(), names.size());
+		return 1;
+	}
+
+	// data beyond the high-water marks is never read, thus can be omitted
+	uint32_t imageSize = deviceSize;
+	if (!fullImage)
+	{
+		imageSize = 0;
+		for (int i = 0; i < flashFs.numFiles(); ++i)
+		{
+			const auto entry = flashFs.fileEntry(i);
+			imageSize = std::max(imageSize, entry->startAddress + entry->written);
+		}
+		imageSize = std::max(imageSize, om::FlashFS::directorySize());
+		imageSize = (imageSize + pageSize - 1) & ~uint32_t(pageSize - 1);
+	}
+
+	FILE* image = fopen(imageName, "wb");
+	if (   (image == nullptr)
+		|| (fwrite(memory.data(), 1, imageSize, image) != imageSize)
+		|| (fclose(image) != 0))
+	{
+		fprintf(stderr, "mkflashfs: can't write %s\n", imageName);
+		return 1;
+	}
+	printf("%s: %d files, image %u bytes of %u\n", imageName, flashFs.numFiles(), imageSize, deviceSize);
+	return 0;
+}
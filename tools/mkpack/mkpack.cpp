@@ -0,0 +1,225 @@
+// mkpack: builds an om::ResourcePack file from a directory of assets on the
+// host. The minimal perfect hash is found by hash and displace: the buckets
+// are placed largest first, each trying seeds until all its names hit free
+// slots. Optionally writes a C++ header of the asset ids.
+//
+// usage: mkpack [-H header] -o pack dir
+
+#include <Arduino.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ResourcePack.h"
+
+namespace {
+
+typedef om::ResourcePack Pack;
+
+void usage()
+{
+	fprintf(stderr, "usage: mkpack [-H header] -o pack dir\n"
+					"  -H  C++ header of the asset ids, enum ASSET_<NAME>\n");
+}
+
+bool readFile(const std::string& path, std::vector<char>& content)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		return false;
+	content.clear();
+	char buffer[4096];
+	for (size_t n; (n = fread(buffer, 1, sizeof(buffer), file)) > 0; )
+		content.insert(content.end(), buffer, buffer + n);
+	const bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+// slot of each name, false if no seed separates a bucket
+bool placeNames(const std::vector<std::string>& names, uint16_t buckets
+			  , std::vector<uint16_t>& seeds, std::vector<uint16_t>& slots)
+{
+	const uint32_t count = names.size();
+	std::vector<std::vector<uint32_t>> members(buckets);
+	for (uint32_t i = 0; i < count; ++i)
+		members[Pack::hashName(names[i].c_str(), 0) % buckets].push_back(i);
+
+	std::vector<uint16_t> order(buckets);
+	for (uint16_t b = 0; b < buckets; ++b)
+		order[b] = b;
+	std::stable_sort(order.begin(), order.end(), [&](uint16_t a, uint16_t b)
+	{
+		return members[a].size() > members[b].size();
+	});
+
+	std::vector<bool> taken(count, false);
+	seeds.assign(buckets, 0);
+	slots.assign(count, 0);
+	for (const uint16_t b : order)
+	{
+		if (members[b].empty())
+			break;
+
+		uint32_t seed = 1;
+		for (; seed <= 0xFFFF; ++seed)
+		{
+			std::vector<uint16_t> hit;
+			for (const uint32_t i : members[b])
+			{
+				const uint16_t slot = Pack::hashName(names[i].c_str(), seed) % count;
+				if (taken[slot] || (std::find(hit.begin(), hit.end(), slot) != hit.end()))
+					break;
+				hit.push_back(slot);
+			}
+			if (hit.size() < members[b].size())
+				continue;
+
+			for (size_t k = 0; k < hit.size(); ++k)
+			{
+				taken[hit[k]] = true;
+				slots[members[b][k]] = hit[k];
+			}
+			break;
+		}
+		if (seed > 0xFFFF)
+			return false;
+		seeds[b] = seed;
+	}
+	return true;
+}
+
+std::string identifier(const std::string& name)
+{
+	std::string id = "ASSET_";
+	for (const char c : name)
+		id += isalnum(uint8_t(c)) ? char(toupper(uint8_t(c))) : '_';
+	return id;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	const char* packName = nullptr;
+	const char* headerName = nullptr;
+
+	for (int opt; (opt = getopt(argc, argv, "H:o:")) != -1; )
+	{
+		switch (opt)
+		{
+		case 'H': headerName = optarg;						break;
+		case 'o': packName = optarg;						break;
+		default:  usage();									return 1;
+		}
+	}
+	if ((packName == nullptr) || (optind + 1 != argc))
+	{
+		usage();
+		return 1;
+	}
+
+	// collect the assets, sorted by name for reproducible packs
+	const std::string source = argv[optind];
+	std::vector<std::string> names;
+	DIR* dir = opendir(source.c_str());
+	if (dir == nullptr)
+	{
+		fprintf(stderr, "mkpack: can't open %s\n", source.c_str());
+		return 1;
+	}
+	while (const dirent* entry = readdir(dir))
+	{
+		struct stat info;
+		const std::string path = source + "/" + entry->d_name;
+		if ((stat(path.c_str(), &info) == 0) && S_ISREG(info.st_mode))
+			names.push_back(entry->d_name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	if (names.size() > 0xFFFF)
+	{
+		fprintf(stderr, "mkpack: too many assets\n");
+		return 1;
+	}
+
+	for (size_t i = 1; i < names.size(); ++i)
+		for (size_t k = 0; k < i; ++k)
+			if (Pack::hashName(names[i].c_str(), 0) == Pack::hashName(names[k].c_str(), 0))
+			{
+				fprintf(stderr, "mkpack: hash collision of %s and %s, rename one\n"
+							  , names[k].c_str(), names[i].c_str());
+				return 1;
+			}
+
+	Pack::Header header = { Pack::MAGIC_PACK, uint16_t(names.size()), 0, 0 };
+	header.buckets = (header.count + Pack::BUCKETLOAD - 1) / Pack::BUCKETLOAD;
+	std::vector<uint16_t> seeds, slots;
+	if (!placeNames(names, header.buckets, seeds, slots))
+	{
+		fprintf(stderr, "mkpack: no perfect hash found\n");
+		return 1;
+	}
+
+	// the assets follow the tables tightly in id order
+	std::vector<Pack::Entry> entries(header.count);
+	std::vector<std::vector<char>> contents(header.count);
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (!readFile(source + "/" + names[i], contents[slots[i]]))
+		{
+			fprintf(stderr, "mkpack: can't read %s\n", names[i].c_str());
+			return 1;
+		}
+		entries[slots[i]].size = contents[slots[i]].size();
+		entries[slots[i]].check = Pack::hashName(names[i].c_str(), 0);
+	}
+	uint32_t offset = sizeof(header) + seeds.size() * sizeof(uint16_t)
+					+ entries.size() * sizeof(Pack::Entry);
+	for (Pack::Entry& entry : entries)
+	{
+		entry.offset = offset;
+		offset += entry.size;
+	}
+
+	FILE* pack = fopen(packName, "wb");
+	bool ok = (pack != nullptr)
+		   && (fwrite(&header, sizeof(header), 1, pack) == 1)
+		   && (fwrite(seeds.data(), sizeof(uint16_t), seeds.size(), pack) == seeds.size())
+		   && (fwrite(entries.data(), sizeof(Pack::Entry), entries.size(), pack) == entries.size());
+	for (const std::vector<char>& content : contents)
+		ok = ok && (fwrite(content.data(), 1, content.size(), pack) == content.size());
+	if ((pack == nullptr) || (fclose(pack) != 0) || !ok)
+	{
+		fprintf(stderr, "mkpack: can't write %s\n", packName);
+		return 1;
+	}
+
+	if (headerName != nullptr)
+	{
+		FILE* ids = fopen(headerName, "w");
+		ok = (ids != nullptr);
+		if (ok)
+		{
+			fprintf(ids, "// asset ids of %s, generated by mkpack\n#pragma once\n\n#include <stdint.h>\n\nenum : uint16_t\n{\n", packName);
+			for (size_t i = 0; i < names.size(); ++i)
+				fprintf(ids, "\t%s = %u,\n", identifier(names[i]).c_str(), slots[i]);
+			fprintf(ids, "};\n");
+		}
+		if ((ids == nullptr) || (fclose(ids) != 0) || !ok)
+		{
+			fprintf(stderr, "mkpack: can't write %s\n", headerName);
+			return 1;
+		}
+	}
+
+	for (size_t i = 0; i < names.size(); ++i)
+		printf("%5u %-24s %7u\n", slots[i], names[i].c_str(), entries[slots[i]].size);
+	printf("%s: %u assets, %u bytes\n", packName, header.count, offset);
+	return 0;
+}